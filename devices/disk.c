@@ -3,10 +3,18 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include "devices/pci.h"
 #include "devices/timer.h"
+#include "devices/virtio-blk.h"
 #include "threads/io.h"
+#include "intrinsic.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -14,6 +22,7 @@
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
 #define reg_error(CHANNEL) ((CHANNEL)->reg_base + 1)    /* Error. */
+#define reg_features(CHANNEL) reg_error (CHANNEL)       /* Features (w/o). */
 #define reg_nsect(CHANNEL) ((CHANNEL)->reg_base + 2)    /* Sector Count. */
 #define reg_lbal(CHANNEL) ((CHANNEL)->reg_base + 3)     /* LBA 0:7. */
 #define reg_lbam(CHANNEL) ((CHANNEL)->reg_base + 4)     /* LBA 15:8. */
@@ -32,6 +41,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +57,51 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+#define CMD_SET_FEATURES 0xef           /* SET FEATURES. */
+
+/* SET FEATURES subcommands, written to the Features register. */
+#define FEAT_ENABLE_WCACHE 0x02         /* Enable write cache. */
+
+/* Bus-master IDE (BMIDE) register addresses, relative to a
+   channel's bm_base.  See the PIIX datasheet. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)  /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)   /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)     /* PRD table. */
+
+/* Bus-master command register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* 1=Write to memory (disk read). */
+
+/* Bus-master status register bits. */
+#define BM_ST_ACTIVE 0x01       /* Transfer in progress. */
+#define BM_ST_ERR 0x02          /* DMA error (write 1 to clear). */
+#define BM_ST_IRQ 0x04          /* Interrupt (write 1 to clear). */
+
+/* Physical region descriptor: one scatter/gather segment of a DMA
+   transfer.  A segment may not cross a 64 kB boundary. */
+struct prd {
+	uint32_t addr;              /* Physical base address. */
+	uint16_t size;              /* Byte count; 0 means 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last entry. */
+};
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_BOUNDARY 0x10000    /* Segments may not cross this. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Request queue tuning.  Queued requests of the highest I/O class
+   present are served in elevator order, but a request whose deadline
+   has passed goes first, which bounds how long lower classes can be
+   starved.  Deadlines grow by the base amount for each class below
+   the top one. */
+#define READ_EXPIRE (TIMER_FREQ / 20)   /* Reads: 50 ms. */
+#define WRITE_EXPIRE (TIMER_FREQ / 2)   /* Writes: 500 ms. */
+#define MERGE_MAX 32                    /* Most requests one command serves. */
 
 /* An ATA device. */
 struct disk {
@@ -56,9 +111,19 @@ struct disk {
 
 	bool is_ata;                /* 1=This device is an ATA disk. */
 	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+	int multiple;               /* Sectors per DRQ block of READ/WRITE
+								   MULTIPLE, or 0 if unsupported. */
+	bool dma;                   /* Supports READ/WRITE DMA? */
+	bool write_cache;           /* Write cache enabled? */
+	struct virtio_blk *vblk;    /* Backing virtio device if not ATA. */
+
+	struct list queue;          /* Pending disk_requests, oldest first. */
+	disk_sector_t head;         /* Sector after the last one served. */
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+	struct disk_stat stat;      /* Latency and traffic statistics. */
+	disk_sector_t last_end;     /* Sector after the last one completed. */
 };
 
 /* An ATA channel (aka controller).
@@ -73,6 +138,13 @@ struct channel {
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+	uint16_t bm_base;           /* Bus-master I/O base, or 0 for PIO only. */
+	struct prd *prdt;           /* PRD table, one page. */
+
+	struct lock queue_lock;     /* Protects the devices' queues. */
+	struct condition queue_ready;   /* Signaled when a request arrives. */
+	int next_dev;               /* Device the I/O thread serves next. */
+
 	struct disk devices[2];     /* The devices on this channel. */
 };
 
@@ -84,7 +156,23 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void set_multiple_mode (struct disk *, uint16_t max_multiple);
+static bool set_feature (struct disk *, uint8_t feature);
+static void flush_cache (struct disk *);
+static uint16_t find_bmide (void);
+
+static bool dma_usable (const struct disk *, const void *, size_t sec_cnt);
+static void dma_transfer (struct disk *, disk_sector_t,
+		struct disk_request **, size_t req_cnt, bool write);
+static void pio_transfer (struct disk *, disk_sector_t, size_t sec_cnt,
+		struct disk_request **, size_t req_cnt, bool write);
+
+static void io_thread (void *channel_);
+static struct disk_request *elevator_next (struct disk *);
+static size_t elevator_collect (struct disk *, struct disk_request **);
+static void dispatch (struct disk *, struct disk_request **, size_t req_cnt);
+
+static void select_sector (struct disk *, disk_sector_t, size_t sec_cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -96,10 +184,14 @@ static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static void print_disk_stat (struct disk *);
+static void account (struct disk *, const struct disk_request *);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) {
 	size_t chan_no;
+	uint16_t bmide = find_bmide ();
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
 		struct channel *c = &channels[chan_no];
@@ -122,6 +214,16 @@ disk_init (void) {
 		lock_init (&c->lock);
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		lock_init (&c->queue_lock);
+		cond_init (&c->queue_ready);
+		c->next_dev = 0;
+
+		/* Use bus-master DMA if the controller has it.  Each channel
+		   owns 8 bytes of the BMIDE register block. */
+		c->bm_base = 0;
+		c->prdt = NULL;
+		if (bmide != 0 && (c->prdt = palloc_get_page (PAL_ZERO)) != NULL)
+			c->bm_base = bmide + 8 * chan_no;
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -132,8 +234,16 @@ disk_init (void) {
 
 			d->is_ata = false;
 			d->capacity = 0;
+			d->multiple = 0;
+			d->dma = false;
+			d->write_cache = false;
+			d->vblk = NULL;
+			list_init (&d->queue);
+			d->head = 0;
 
 			d->read_cnt = d->write_cnt = 0;
+			memset (&d->stat, 0, sizeof d->stat);
+			d->last_end = 0;
 		}
 
 		/* Register interrupt handler. */
@@ -150,6 +260,17 @@ disk_init (void) {
 		for (dev_no = 0; dev_no < 2; dev_no++)
 			if (c->devices[dev_no].is_ata)
 				identify_ata_device (&c->devices[dev_no]);
+
+		/* Start the thread that serves this channel's queues. */
+		if (c->devices[0].is_ata || c->devices[1].is_ata)
+			thread_create (c->name, PRI_MAX, io_thread, c);
+	}
+
+	/* Disk slots without an ATA disk may be backed by virtio-blk. */
+	for (int slot = 0; slot < VIRTIO_BLK_SLOTS; slot++) {
+		struct disk *d = &channels[slot / 2].devices[slot % 2];
+		if (!d->is_ata)
+			d->vblk = virtio_blk_probe (slot, d->name, &d->capacity);
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
@@ -166,13 +287,56 @@ disk_print_stats (void) {
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
+			if (d != NULL) {
 				printf ("%s: %lld reads, %lld writes\n",
 						d->name, d->read_cnt, d->write_cnt);
+				print_disk_stat (d);
+			}
 		}
 	}
 }
 
+/* Prints D's latency and traffic statistics, one line per
+   direction plus a line per nonempty histogram. */
+static void
+print_disk_stat (struct disk *d) {
+	static const char *dir_names[DISK_DIR_CNT] = { "read", "write" };
+	struct disk_stat st;
+	int dir, i;
+
+	disk_get_stat (d, &st);
+	for (dir = 0; dir < DISK_DIR_CNT; dir++) {
+		const struct disk_dir_stat *ds = &st.dir[dir];
+		if (ds->requests == 0)
+			continue;
+		printf ("%s: %s: %"PRIu64" requests (%"PRIu64" sequential), "
+				"%"PRIu64" bytes, mean %"PRIu64" cycles\n",
+				d->name, dir_names[dir], ds->requests, ds->sequential,
+				ds->bytes, ds->cycles / ds->requests);
+		printf ("%s: %s latency log2(cycles):", d->name, dir_names[dir]);
+		for (i = 0; i < DISK_LAT_BUCKETS; i++)
+			if (ds->latency[i] != 0)
+				printf (" %d:%"PRIu64, i, ds->latency[i]);
+		printf ("\n");
+	}
+	printf ("%s: %"PRIu64" flushes, %"PRIu64" cycles busy\n",
+			d->name, st.flushes, st.busy_cycles);
+}
+
+/* Copies D's statistics into *ST. */
+void
+disk_get_stat (struct disk *d, struct disk_stat *st) {
+	enum intr_level old_level;
+
+	ASSERT (d != NULL);
+
+	/* virtio completions update the statistics from interrupt
+	   context. */
+	old_level = intr_disable ();
+	*st = d->stat;
+	intr_set_level (old_level);
+}
+
 /* Returns the disk numbered DEV_NO--either 0 or 1 for master or
    slave, respectively--within the channel numbered CHAN_NO.
 
@@ -188,7 +352,7 @@ disk_get (int chan_no, int dev_no) {
 
 	if (chan_no < (int) CHANNEL_CNT) {
 		struct disk *d = &channels[chan_no].devices[dev_no];
-		if (d->is_ata)
+		if (d->is_ata || d->vblk != NULL)
 			return d;
 	}
 	return NULL;
@@ -209,21 +373,7 @@ disk_size (struct disk *d) {
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multi (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,23 +383,220 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	disk_write_multi (d, sec_no, 1, buffer);
+}
+
+/* Reads SEC_CNT contiguous sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for SEC_CNT * DISK_SECTOR_SIZE
+   bytes.  SEC_CNT must be between 1 and DISK_MULTI_MAX.
+   The transfer is issued as a single command: DMA where possible,
+   otherwise READ MULTIPLE, so that the disk interrupts once per
+   block of D->multiple sectors rather than once per sector. */
+void
+disk_read_multi (struct disk *d, disk_sector_t sec_no, size_t sec_cnt,
+		void *buffer) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, sec_cnt, buffer, false);
+	disk_submit (&r);
+	disk_request_wait (&r);
+}
+
+/* Writes SEC_CNT contiguous sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain SEC_CNT * DISK_SECTOR_SIZE
+   bytes.  SEC_CNT must be between 1 and DISK_MULTI_MAX.
+   Returns after the disk has acknowledged receiving the data.
+   Like disk_read_multi(), uses one command for the whole range. */
+void
+disk_write_multi (struct disk *d, disk_sector_t sec_no, size_t sec_cnt,
+		const void *buffer) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, sec_cnt, (void *) buffer, true);
+	disk_submit (&r);
+	disk_request_wait (&r);
+}
+
+/* Makes every write to disk D that completed before the call
+   durable, by draining the disk's write cache.  Queued requests
+   submitted earlier are served before the flush and later ones
+   after it, so the flush is also an ordering barrier. */
+void
+disk_flush (struct disk *d) {
+	struct disk_request r;
 
+	ASSERT (d != NULL);
+
+	r.disk = d;
+	r.sector = 0;
+	r.sec_cnt = 0;
+	r.buffer = NULL;
+	r.write = true;
+	r.flush = true;
+	r.done = NULL;
+	r.aux = NULL;
+	sema_init (&r.complete, 0);
+	disk_submit (&r);
+	disk_request_wait (&r);
+}
+
+/* Asynchronous requests. */
+
+/* Initializes R to transfer SEC_CNT sectors starting at SEC_NO
+   between disk D and BUFFER, which must stay valid until R
+   completes.  Writes to the disk if WRITE is true.  R->done is
+   left null; set it before disk_submit() to be called back
+   instead of waiting. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+		disk_sector_t sec_no, size_t sec_cnt, void *buffer, bool write) {
+	ASSERT (r != NULL);
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
+	ASSERT (sec_cnt > 0 && sec_cnt <= DISK_MULTI_MAX);
+	ASSERT (sec_no < d->capacity && sec_cnt <= d->capacity - sec_no);
+
+	r->disk = d;
+	r->sector = sec_no;
+	r->sec_cnt = sec_cnt;
+	r->buffer = buffer;
+	r->write = write;
+	r->flush = false;
+	r->done = NULL;
+	r->aux = NULL;
+	sema_init (&r->complete, 0);
+}
 
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
-	lock_release (&c->lock);
+/* Queues R on its disk and returns at once.  R's I/O class comes
+   from the current thread's priority, which already reflects
+   donation and, under the MLFQS, niceness.  The disk's I/O thread
+   serves the highest class queued first, in C-LOOK order within a
+   class, merging requests for adjacent sectors into one command,
+   except that a request whose deadline has passed is served
+   first.
+   Requests for overlapping sectors are not ordered against each
+   other; callers must not have both in flight.
+   Disks backed by virtio-blk take the request directly, since the
+   device keeps many in flight and orders them itself. */
+void
+disk_submit (struct disk_request *r) {
+	struct channel *c = r->disk->channel;
+
+	r->io_class = thread_get_priority () * DISK_IO_CLASS_CNT / (PRI_MAX + 1);
+	r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE)
+		* (DISK_IO_CLASS_CNT - r->io_class);
+	r->submit_tsc = rdtsc ();
+	if (r->disk->vblk != NULL) {
+		/* The device queues and schedules requests itself. */
+		virtio_blk_submit (r->disk->vblk, r);
+		return;
+	}
+	lock_acquire (&c->queue_lock);
+	list_push_back (&r->disk->queue, &r->elem);
+	cond_signal (&c->queue_ready, &c->queue_lock);
+	lock_release (&c->queue_lock);
 }
-
+
+/* Accounts for finished request R and notifies its submitter.
+   Called by the block drivers, possibly from an interrupt
+   handler. */
+void
+disk_complete (struct disk_request *r) {
+	struct disk *d = r->disk;
+
+	if (r->write)
+		d->write_cnt += r->sec_cnt;
+	else
+		d->read_cnt += r->sec_cnt;
+	account (d, r);
+	if (r->done != NULL)
+		r->done (r);
+	else
+		sema_up (&r->complete);
+}
+
+/* Records finished request R in D's statistics.  Completions for
+   one disk never run concurrently: they come either from its
+   channel's I/O thread or from its virtio interrupt. */
+static void
+account (struct disk *d, const struct disk_request *r) {
+	struct disk_dir_stat *ds;
+	uint64_t latency = rdtsc () - r->submit_tsc;
+	int bucket;
+
+	if (r->flush) {
+		d->stat.flushes++;
+		return;
+	}
+
+	ds = &d->stat.dir[r->write ? DISK_DIR_WRITE : DISK_DIR_READ];
+	ds->requests++;
+	if (r->sector == d->last_end)
+		ds->sequential++;
+	ds->bytes += (uint64_t) r->sec_cnt * DISK_SECTOR_SIZE;
+	ds->cycles += latency;
+	bucket = latency > 1 ? 63 - __builtin_clzll (latency) : 0;
+	ds->latency[bucket < DISK_LAT_BUCKETS ? bucket : DISK_LAT_BUCKETS - 1]++;
+	d->last_end = r->sector + r->sec_cnt;
+}
+
+/* Waits until R, which must have a null R->done, completes. */
+void
+disk_request_wait (struct disk_request *r) {
+	ASSERT (r->done == NULL);
+	sema_down (&r->complete);
+}
+
+static void
+batch_done (struct disk_request *r) {
+	struct disk_batch *b = r->aux;
+	sema_up (&b->complete);
+}
+
+/* Initializes B as an empty batch. */
+void
+disk_batch_init (struct disk_batch *b) {
+	list_init (&b->requests);
+	sema_init (&b->complete, 0);
+}
+
+/* Submits a request to transfer SEC_CNT sectors starting at SEC_NO
+   between disk D and BUFFER as part of batch B.  If no memory is
+   available for the request, performs the transfer synchronously
+   instead. */
+void
+disk_batch_add (struct disk_batch *b, struct disk *d, disk_sector_t sec_no,
+		size_t sec_cnt, void *buffer, bool write) {
+	struct disk_request *r = malloc (sizeof *r);
+
+	if (r == NULL) {
+		if (write)
+			disk_write_multi (d, sec_no, sec_cnt, buffer);
+		else
+			disk_read_multi (d, sec_no, sec_cnt, buffer);
+		return;
+	}
+	disk_request_init (r, d, sec_no, sec_cnt, buffer, write);
+	r->done = batch_done;
+	r->aux = b;
+	list_push_back (&b->requests, &r->batch_elem);
+	disk_submit (r);
+}
+
+/* Waits for every request in B to complete and releases them.
+   B is empty afterward and may be reused.  Requests can complete
+   in any order, so none is freed until all of them have. */
+void
+disk_batch_wait (struct disk_batch *b) {
+	size_t cnt = list_size (&b->requests);
+
+	while (cnt-- > 0)
+		sema_down (&b->complete);
+	while (!list_empty (&b->requests))
+		free (list_entry (list_pop_front (&b->requests),
+				struct disk_request, batch_elem));
+}
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -380,6 +727,70 @@ identify_ata_device (struct disk *d) {
 	printf ("\", serial \"");
 	print_ata_string ((char *) &id[10], 20);
 	printf ("\"\n");
+
+	/* Word 49 bit 8 advertises DMA. */
+	d->dma = (id[49] & 0x0100) != 0;
+
+	/* Word 82 bit 5 advertises a volatile write cache.  With it
+	   on, writes complete once the data reaches the cache, and
+	   disk_flush() provides durability. */
+	if (id[82] & 0x0020)
+		d->write_cache = set_feature (d, FEAT_ENABLE_WCACHE);
+
+	/* Word 47 bits 7:0 give the largest DRQ block that READ/WRITE
+	   MULTIPLE may use. */
+	set_multiple_mode (d, id[47] & 0xff);
+}
+
+/* Enables multiple mode on disk D with the largest supported
+   block of at most MAX_MULTIPLE sectors, recording the block
+   size in D->multiple.  Leaves D->multiple at 0 if the disk
+   rejects the command. */
+static void
+set_multiple_mode (struct disk *d, uint16_t max_multiple) {
+	struct channel *c = d->channel;
+	uint8_t status;
+
+	d->multiple = 0;
+	if (max_multiple == 0)
+		return;
+
+	select_device_wait (d);
+	outb (reg_nsect (c), max_multiple);
+	issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	status = inb (reg_alt_status (c));
+	if ((status & STA_ERR) == 0)
+		d->multiple = max_multiple;
+}
+
+/* Issues SET FEATURES with subcommand FEATURE to disk D.  Returns
+   true if the disk accepted it. */
+static bool
+set_feature (struct disk *d, uint8_t feature) {
+	struct channel *c = d->channel;
+
+	select_device_wait (d);
+	outb (reg_features (c), feature);
+	issue_pio_command (c, CMD_SET_FEATURES);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	return (inb (reg_alt_status (c)) & STA_ERR) == 0;
+}
+
+/* Writes disk D's write cache to the medium, returning once the
+   disk reports completion.  D's channel must be locked. */
+static void
+flush_cache (struct disk *d) {
+	struct channel *c = d->channel;
+
+	select_device_wait (d);
+	issue_pio_command (c, CMD_FLUSH_CACHE);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	if (inb (reg_alt_status (c)) & STA_ERR)
+		PANIC ("%s: disk flush failed", d->name);
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -402,17 +813,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and SEC_CNT to the disk's sector selection
+   registers.  (We use LBA mode.)  A count of DISK_MULTI_MAX is
+   written as 0, which the disk reads as 256. */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t sec_cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (sec_cnt > 0 && sec_cnt <= DISK_MULTI_MAX);
+	ASSERT (sec_no < d->capacity && sec_cnt <= d->capacity - sec_no);
+	ASSERT (sec_no + sec_cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), sec_cnt & 0xff);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -446,6 +859,315 @@ output_sector (struct channel *c, const void *sector) {
 	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* Finds the PCI IDE controller and returns the I/O base of its
+   bus-master register block, enabling bus mastering on the way.
+   Returns 0 if there is no controller capable of bus-master DMA,
+   in which case all transfers use PIO. */
+static uint16_t
+find_bmide (void) {
+	struct pci_addr a;
+	uint32_t bar4;
+
+	/* Class 1 (mass storage), subclass 1 (IDE); prog-if bit 7 says
+	   the controller can master the bus. */
+	if (!pci_find_class (0x01, 0x01, &a)
+			|| !(pci_read_config (&a, PCI_REG_CLASS) & 0x8000))
+		return 0;
+
+	bar4 = pci_read_config (&a, PCI_REG_BAR0 + 4 * 4);
+	if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+		return 0;
+
+	pci_write_config (&a, PCI_REG_COMMAND,
+			(pci_read_config (&a, PCI_REG_COMMAND) & 0xffff)
+			| PCI_CMD_IO | PCI_CMD_MASTER);
+	return bar4 & 0xfffc;
+}
+
+/* Returns true if SEC_CNT sectors at BUFFER can move by DMA on
+   disk D: the controller and disk must both support it, and the
+   buffer must be in the kernel's direct map (hence physically
+   contiguous), word-aligned, and below 4 GB. */
+static bool
+dma_usable (const struct disk *d, const void *buffer, size_t sec_cnt) {
+	uint64_t pa;
+
+	if (d->channel->bm_base == 0 || !d->dma
+			|| !is_kernel_vaddr (buffer) || (uintptr_t) buffer % 2 != 0)
+		return false;
+	pa = vtop (buffer);
+	return pa + sec_cnt * DISK_SECTOR_SIZE <= UINT32_MAX;
+}
+
+/* Moves the sectors starting at SEC_NO between disk D and the
+   buffers of the REQ_CNT requests in REQS, which cover consecutive
+   sectors, with one READ DMA or WRITE DMA command.  Each buffer
+   becomes one or more PRD segments.  The CPU only builds the PRD
+   table and then sleeps until the channel interrupt reports
+   completion. */
+static void
+dma_transfer (struct disk *d, disk_sector_t sec_no,
+		struct disk_request **reqs, size_t req_cnt, bool write) {
+	struct channel *c = d->channel;
+	struct prd *prd = c->prdt;
+	size_t sec_cnt = 0;
+	uint8_t bm_status, status;
+
+	for (size_t i = 0; i < req_cnt; i++) {
+		uint64_t pa = vtop (reqs[i]->buffer);
+		size_t left = reqs[i]->sec_cnt * DISK_SECTOR_SIZE;
+
+		/* Split each buffer at 64 kB boundaries. */
+		for (; left > 0; prd++) {
+			size_t size = PRD_BOUNDARY - pa % PRD_BOUNDARY;
+			if (size > left)
+				size = left;
+
+			ASSERT (prd < c->prdt + PRD_CNT);
+			prd->addr = pa;
+			prd->size = size & 0xffff;
+			prd->flags = 0;
+			pa += size;
+			left -= size;
+		}
+		sec_cnt += reqs[i]->sec_cnt;
+	}
+	prd[-1].flags = PRD_EOT;
+
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+	outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_ST_ERR | BM_ST_IRQ);
+
+	select_sector (d, sec_no, sec_cnt);
+	issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (reg_bm_command (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+	sema_down (&c->completion_wait);
+	outb (reg_bm_command (c), 0);
+
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), bm_status);
+	status = inb (reg_alt_status (c));
+	if ((bm_status & BM_ST_ERR) || (status & STA_ERR))
+		PANIC ("%s: disk DMA %s failed, sector=%"PRDSNu, d->name,
+				write ? "write" : "read", sec_no);
+}
+
+/* PIO counterpart of dma_transfer(), moving SEC_CNT sectors.  Uses
+   READ/WRITE MULTIPLE if the disk has multiple mode enabled,
+   otherwise READ/WRITE SECTOR, which interrupts per sector. */
+static void
+pio_transfer (struct disk *d, disk_sector_t sec_no, size_t sec_cnt,
+		struct disk_request **reqs, size_t req_cnt UNUSED, bool write) {
+	struct channel *c = d->channel;
+	size_t block_max = d->multiple > 0 ? (size_t) d->multiple : 1;
+	size_t r = 0, ofs = 0;
+	size_t left, block;
+
+	select_sector (d, sec_no, sec_cnt);
+	if (write)
+		issue_pio_command (c, d->multiple > 0
+				? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+	else
+		issue_pio_command (c, d->multiple > 0
+				? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+
+	for (left = sec_cnt; left > 0; left -= block) {
+		block = left < block_max ? left : block_max;
+
+		if (!write)
+			sema_down (&c->completion_wait);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+					write ? "write" : "read",
+					(disk_sector_t) (sec_no + (sec_cnt - left)));
+		for (size_t i = 0; i < block; i++) {
+			ASSERT (r < req_cnt);
+			uint8_t *p = (uint8_t *) reqs[r]->buffer + ofs * DISK_SECTOR_SIZE;
+			if (write)
+				output_sector (c, p);
+			else
+				input_sector (c, p);
+			if (++ofs == reqs[r]->sec_cnt) {
+				r++;
+				ofs = 0;
+			}
+		}
+		if (write)
+			sema_down (&c->completion_wait);
+	}
+}
+
+/* Request queue. */
+
+/* Serves the request queues of CHANNEL_'s disks, forever. */
+static void
+io_thread (void *channel_) {
+	struct channel *c = channel_;
+
+	for (;;) {
+		struct disk_request *reqs[MERGE_MAX];
+		struct disk *d = NULL;
+		size_t req_cnt;
+
+		lock_acquire (&c->queue_lock);
+		while (d == NULL) {
+			/* Alternate between the two devices when both are busy. */
+			for (int i = 0; i < 2 && d == NULL; i++) {
+				struct disk *cand = &c->devices[(c->next_dev + i) % 2];
+				if (!list_empty (&cand->queue)) {
+					d = cand;
+					c->next_dev = (cand->dev_no + 1) % 2;
+				}
+			}
+			if (d == NULL)
+				cond_wait (&c->queue_ready, &c->queue_lock);
+		}
+		req_cnt = elevator_collect (d, reqs);
+		lock_release (&c->queue_lock);
+
+		dispatch (d, reqs, req_cnt);
+	}
+}
+
+/* Chooses the next request to serve from D's nonempty queue: the
+   one with the earliest deadline if that has passed, otherwise,
+   among the requests of the highest I/O class queued, the one with
+   the lowest sector at or beyond the head, wrapping around to the
+   lowest sector in that class (C-LOOK). */
+static struct disk_request *
+elevator_next (struct disk *d) {
+	struct disk_request *urgent = NULL, *ahead = NULL, *lowest = NULL;
+	int io_class = -1;
+	struct list_elem *e;
+
+	/* A flush is a barrier: only requests queued ahead of the first
+	   one may be chosen, and it goes once they are gone. */
+	for (e = list_begin (&d->queue); e != list_end (&d->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		if (r->flush) {
+			if (urgent == NULL)
+				return r;
+			break;
+		}
+		if (urgent == NULL || r->deadline < urgent->deadline)
+			urgent = r;
+		if (r->io_class > io_class)
+			io_class = r->io_class;
+	}
+	if (timer_ticks () >= urgent->deadline)
+		return urgent;
+
+	for (e = list_begin (&d->queue); e != list_end (&d->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+		if (r->flush)
+			break;
+		if (r->io_class != io_class)
+			continue;
+		if (r->sector >= d->head && (ahead == NULL || r->sector < ahead->sector))
+			ahead = r;
+		if (lowest == NULL || r->sector < lowest->sector)
+			lowest = r;
+	}
+	return ahead != NULL ? ahead : lowest;
+}
+
+/* Removes the next request from D's queue, together with any
+   requests in the same direction for the sectors just before or
+   after it, and stores them into REQS in sector order.  Returns the
+   number of requests stored, at most MERGE_MAX, which together span
+   at most DISK_MULTI_MAX sectors. */
+static size_t
+elevator_collect (struct disk *d, struct disk_request **reqs) {
+	struct disk_request *first = elevator_next (d);
+	disk_sector_t start = first->sector;
+	disk_sector_t end = start + first->sec_cnt;
+	size_t req_cnt = 1;
+	bool merged;
+
+	list_remove (&first->elem);
+	reqs[0] = first;
+	if (first->flush)
+		return 1;
+	do {
+		struct list_elem *e;
+
+		merged = false;
+		for (e = list_begin (&d->queue);
+				e != list_end (&d->queue) && req_cnt < MERGE_MAX;
+				e = list_next (e)) {
+			struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+			if (r->flush)
+				break;
+			if (r->write != first->write
+					|| end - start + r->sec_cnt > DISK_MULTI_MAX)
+				continue;
+			if (r->sector == end) {
+				reqs[req_cnt++] = r;
+				end += r->sec_cnt;
+			} else if (r->sector + r->sec_cnt == start) {
+				memmove (reqs + 1, reqs, req_cnt * sizeof *reqs);
+				reqs[0] = r;
+				req_cnt++;
+				start = r->sector;
+			} else
+				continue;
+			list_remove (e);
+			merged = true;
+			break;
+		}
+	} while (merged);
+	return req_cnt;
+}
+
+/* Performs the REQ_CNT requests in REQS, which cover consecutive
+   sectors in one direction, as a single command on disk D, then
+   completes each of them. */
+static void
+dispatch (struct disk *d, struct disk_request **reqs, size_t req_cnt) {
+	struct channel *c = d->channel;
+	disk_sector_t sec_no = reqs[0]->sector;
+	bool write = reqs[0]->write;
+	size_t sec_cnt = 0;
+	bool dma = true;
+	uint64_t start_tsc;
+
+	if (reqs[0]->flush) {
+		ASSERT (req_cnt == 1);
+		if (d->write_cache) {
+			lock_acquire (&c->lock);
+			start_tsc = rdtsc ();
+			flush_cache (d);
+			d->stat.busy_cycles += rdtsc () - start_tsc;
+			lock_release (&c->lock);
+		}
+		disk_complete (reqs[0]);
+		return;
+	}
+
+	for (size_t i = 0; i < req_cnt; i++) {
+		sec_cnt += reqs[i]->sec_cnt;
+		dma = dma && dma_usable (d, reqs[i]->buffer, reqs[i]->sec_cnt);
+	}
+
+	lock_acquire (&c->lock);
+	start_tsc = rdtsc ();
+	if (dma)
+		dma_transfer (d, sec_no, reqs, req_cnt, write);
+	else
+		pio_transfer (d, sec_no, sec_cnt, reqs, req_cnt, write);
+	d->head = sec_no + sec_cnt;
+	d->stat.busy_cycles += rdtsc () - start_tsc;
+	lock_release (&c->lock);
+
+	for (size_t i = 0; i < req_cnt; i++)
+		disk_complete (reqs[i]);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
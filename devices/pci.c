@@ -0,0 +1,89 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   through the legacy port I/O mechanism ("configuration
+   mechanism #1"), which every PC chipset we run on supports. */
+
+#define PCI_CONFIG_ADDR 0xcf8   /* Configuration address port. */
+#define PCI_CONFIG_DATA 0xcfc   /* Configuration data port. */
+
+#define PCI_BUS_CNT 256
+#define PCI_DEV_CNT 32
+#define PCI_FUNC_CNT 8
+
+typedef bool match_func (const struct pci_addr *, uint32_t id,
+		uint32_t class, const void *aux);
+
+/* Selects register REG of function A for the next access to
+   PCI_CONFIG_DATA. */
+static void
+select_config (const struct pci_addr *a, uint8_t reg) {
+	ASSERT (a->dev < PCI_DEV_CNT && a->func < PCI_FUNC_CNT);
+	ASSERT (reg % 4 == 0);
+
+	outl (PCI_CONFIG_ADDR, 0x80000000u | ((uint32_t) a->bus << 16)
+			| ((uint32_t) a->dev << 11) | ((uint32_t) a->func << 8) | reg);
+}
+
+/* Returns the 32-bit configuration register REG of function A. */
+uint32_t
+pci_read_config (const struct pci_addr *a, uint8_t reg) {
+	select_config (a, reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function A to
+   VALUE. */
+void
+pci_write_config (const struct pci_addr *a, uint8_t reg, uint32_t value) {
+	select_config (a, reg);
+	outl (PCI_CONFIG_DATA, value);
+}
+
+/* Walks every function on every bus and stores the first one for
+   which MATCH returns true into *A.  Returns true if one was
+   found. */
+static bool
+scan (match_func *match, const void *aux, struct pci_addr *a) {
+	for (int bus = 0; bus < PCI_BUS_CNT; bus++)
+		for (int dev = 0; dev < PCI_DEV_CNT; dev++)
+			for (int func = 0; func < PCI_FUNC_CNT; func++) {
+				struct pci_addr cur = { bus, dev, func };
+				uint32_t id = pci_read_config (&cur, PCI_REG_ID);
+
+				if ((id & 0xffff) == 0xffff) {
+					/* No function 0 means no device at all. */
+					if (func == 0)
+						break;
+					continue;
+				}
+				if (match (&cur, id, pci_read_config (&cur, PCI_REG_CLASS), aux)) {
+					*a = cur;
+					return true;
+				}
+				/* Bit 7 of the header type is set on multifunction
+				   devices only. */
+				if (func == 0
+						&& !(pci_read_config (&cur, 0x0c) & 0x00800000))
+					break;
+			}
+	return false;
+}
+
+static bool
+match_class (const struct pci_addr *a UNUSED, uint32_t id UNUSED,
+		uint32_t class, const void *aux) {
+	const uint8_t *want = aux;
+	return (class >> 24) == want[0] && ((class >> 16) & 0xff) == want[1];
+}
+
+/* Finds the first function whose class code is CLASS and subclass
+   is SUBCLASS, and stores its location into *A.  Returns true if
+   successful, false if there is no such function. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *a) {
+	uint8_t want[2] = { class, subclass };
+	return scan (match_class, want, a);
+}
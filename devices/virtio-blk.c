@@ -0,0 +1,318 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file drives virtio block devices through the
+   legacy virtio PCI interface, which QEMU's (transitional)
+   virtio-blk-pci device provides.  See [VIRTIO-1.0] 4.1.4.8
+   "Legacy Interfaces: A Note on PCI Device Layout" and 5.2
+   "Block Device". */
+
+#define VIRTIO_VENDOR 0x1af4            /* Red Hat, Inc. */
+#define VIRTIO_BLK_DEVICE 0x1001        /* Transitional virtio-blk. */
+
+/* utils/pintos attaches the virtio disk for slot N (0=hd0:0,
+   1=hd0:1, 2=hd1:0, 3=hd1:1) at this PCI device number on bus 0. */
+#define SLOT_PCI_DEV(N) (8 + (N))
+
+/* Legacy register addresses. */
+#define reg_device_features(V) ((V)->io_base + 0x00)  /* Device features. */
+#define reg_guest_features(V) ((V)->io_base + 0x04)   /* Driver features. */
+#define reg_queue_pfn(V) ((V)->io_base + 0x08)        /* Queue address. */
+#define reg_queue_size(V) ((V)->io_base + 0x0c)       /* Queue size (r/o). */
+#define reg_queue_select(V) ((V)->io_base + 0x0e)     /* Queue select. */
+#define reg_queue_notify(V) ((V)->io_base + 0x10)     /* Queue notify. */
+#define reg_status(V) ((V)->io_base + 0x12)           /* Device status. */
+#define reg_isr(V) ((V)->io_base + 0x13)              /* ISR (r/o). */
+#define reg_capacity(V) ((V)->io_base + 0x14)         /* Capacity, 64 bits. */
+
+/* Device status bits. */
+#define STATUS_ACK 0x01                 /* Guest noticed the device. */
+#define STATUS_DRIVER 0x02              /* Guest can drive it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+
+/* Descriptor flags. */
+#define DESC_F_NEXT 0x1                 /* Chain continues in NEXT. */
+#define DESC_F_WRITE 0x2                /* Device writes the buffer. */
+
+/* Feature bits. */
+#define BLK_F_FLUSH (1u << 9)           /* Flush command; write-back cache. */
+
+/* Block request types and status. */
+#define BLK_T_IN 0                      /* Read. */
+#define BLK_T_OUT 1                     /* Write. */
+#define BLK_T_FLUSH 4                   /* Flush. */
+#define BLK_S_OK 0                      /* Success. */
+
+#define VRING_ALIGN 4096                /* Alignment of the used ring. */
+#define DESC_PER_REQ 3                  /* Header, data, status. */
+
+/* Virtqueue layout. */
+struct vring_desc {
+	uint64_t addr;              /* Physical address. */
+	uint32_t len;               /* Length in bytes. */
+	uint16_t flags;             /* DESC_F_*. */
+	uint16_t next;              /* Next descriptor if DESC_F_NEXT. */
+};
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;               /* Where the driver puts the next entry. */
+	uint16_t ring[];            /* Heads of descriptor chains. */
+};
+
+struct vring_used_elem {
+	uint32_t id;                /* Head of the completed chain. */
+	uint32_t len;               /* Bytes written by the device. */
+};
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;               /* Where the device puts the next entry. */
+	struct vring_used_elem ring[];
+};
+
+/* An in-flight request.  Slot I owns descriptors
+   I * DESC_PER_REQ through I * DESC_PER_REQ + 2. */
+struct vblk_slot {
+	struct {
+		uint32_t type;          /* BLK_T_*. */
+		uint32_t reserved;
+		uint64_t sector;        /* First sector. */
+	} hdr;                      /* Read by the device. */
+	uint8_t status;             /* Written by the device. */
+	struct disk_request *req;   /* Request being served. */
+	int next_free;              /* Next free slot, or -1. */
+};
+
+/* A virtio-blk device. */
+struct virtio_blk {
+	char name[8];               /* Name of the disk it backs. */
+	uint16_t io_base;           /* Legacy register base. */
+	uint8_t irq;                /* Interrupt line. */
+	bool flush;                 /* Negotiated BLK_F_FLUSH? */
+
+	uint16_t queue_size;        /* Entries in the virtqueue. */
+	struct vring_desc *desc;    /* Descriptor table. */
+	struct vring_avail *avail;  /* Available ring. */
+	struct vring_used *used;    /* Used ring. */
+	uint16_t used_idx;          /* Next used entry to consume. */
+
+	struct vblk_slot *slots;    /* queue_size / DESC_PER_REQ slots. */
+	int free_slot;              /* First free slot, or -1. */
+	struct semaphore slot_wait; /* Counts free slots. */
+};
+
+static struct virtio_blk *vblks[VIRTIO_BLK_SLOTS];
+
+static void interrupt_handler (struct intr_frame *);
+
+/* Looks for a virtio-blk device backing disk slot SLOT and, if
+   there is one, initializes it and returns it, storing its size in
+   sectors into *CAPACITY.  NAME is the name of the disk it backs.
+   Returns a null pointer if there is no such device or it cannot
+   be set up. */
+struct virtio_blk *
+virtio_blk_probe (int slot, const char *name, disk_sector_t *capacity) {
+	struct pci_addr a = { 0, SLOT_PCI_DEV (slot), 0 };
+	struct virtio_blk *v;
+	uint32_t bar0, id;
+	uint64_t sectors;
+	size_t avail_ofs, used_ofs, ring_size, slot_cnt;
+	uint8_t *ring;
+	bool irq_registered = false;
+
+	ASSERT (slot >= 0 && slot < VIRTIO_BLK_SLOTS);
+
+	id = pci_read_config (&a, PCI_REG_ID);
+	if (id != (((uint32_t) VIRTIO_BLK_DEVICE << 16) | VIRTIO_VENDOR))
+		return NULL;
+	bar0 = pci_read_config (&a, PCI_REG_BAR0);
+	if (!(bar0 & 1))
+		return NULL;
+
+	v = calloc (1, sizeof *v);
+	if (v == NULL)
+		return NULL;
+	strlcpy (v->name, name, sizeof v->name);
+	v->io_base = bar0 & 0xfffc;
+	v->irq = pci_read_config (&a, PCI_REG_IRQ) & 0xff;
+
+	/* IRQs 14 and 15 belong to the ATA channels. */
+	if (v->irq >= 14) {
+		printf ("%s: virtio-blk on unusable irq %d\n", v->name, v->irq);
+		goto fail;
+	}
+
+	pci_write_config (&a, PCI_REG_COMMAND,
+			(pci_read_config (&a, PCI_REG_COMMAND) & 0xffff)
+			| PCI_CMD_IO | PCI_CMD_MASTER);
+
+	/* Reset, then announce ourselves.  The only optional feature
+	   we take is FLUSH, which lets the device cache writes; without
+	   it the device must write through. */
+	outb (reg_status (v), 0);
+	outb (reg_status (v), STATUS_ACK);
+	outb (reg_status (v), STATUS_ACK | STATUS_DRIVER);
+	v->flush = (inl (reg_device_features (v)) & BLK_F_FLUSH) != 0;
+	outl (reg_guest_features (v), v->flush ? BLK_F_FLUSH : 0);
+
+	/* Set up virtqueue 0, the only one virtio-blk has. */
+	outw (reg_queue_select (v), 0);
+	v->queue_size = inw (reg_queue_size (v));
+	if (v->queue_size < DESC_PER_REQ)
+		goto fail;
+	avail_ofs = sizeof (struct vring_desc) * v->queue_size;
+	used_ofs = ROUND_UP (avail_ofs + sizeof (uint16_t) * (3 + v->queue_size),
+			VRING_ALIGN);
+	ring_size = used_ofs + sizeof (struct vring_used)
+		+ sizeof (struct vring_used_elem) * v->queue_size + sizeof (uint16_t);
+	ring = palloc_get_multiple (PAL_ZERO, DIV_ROUND_UP (ring_size, PGSIZE));
+	if (ring == NULL)
+		goto fail;
+	v->desc = (struct vring_desc *) ring;
+	v->avail = (struct vring_avail *) (ring + avail_ofs);
+	v->used = (struct vring_used *) (ring + used_ofs);
+	v->used_idx = 0;
+
+	slot_cnt = v->queue_size / DESC_PER_REQ;
+	v->slots = calloc (slot_cnt, sizeof *v->slots);
+	if (v->slots == NULL) {
+		palloc_free_multiple (ring, DIV_ROUND_UP (ring_size, PGSIZE));
+		goto fail;
+	}
+	for (size_t i = 0; i < slot_cnt; i++)
+		v->slots[i].next_free = i + 1 < slot_cnt ? (int) i + 1 : -1;
+	v->free_slot = 0;
+	sema_init (&v->slot_wait, slot_cnt);
+
+	outl (reg_queue_pfn (v), vtop (ring) / VRING_ALIGN);
+
+	/* Devices may share an interrupt line; the handler serves all
+	   of them. */
+	for (int i = 0; i < VIRTIO_BLK_SLOTS; i++)
+		if (vblks[i] != NULL && vblks[i]->irq == v->irq)
+			irq_registered = true;
+	vblks[slot] = v;
+	if (!irq_registered)
+		intr_register_ext (0x20 + v->irq, interrupt_handler, "virtio-blk");
+
+	outb (reg_status (v), STATUS_ACK | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+	sectors = inl (reg_capacity (v)) | ((uint64_t) inl (reg_capacity (v) + 4) << 32);
+	*capacity = sectors < UINT32_MAX ? sectors : UINT32_MAX;
+	printf ("%s: detected %'"PRDSNu" sector virtio disk, %zu requests in flight\n",
+			v->name, *capacity, slot_cnt);
+	return v;
+
+fail:
+	outb (reg_status (v), 0);
+	free (v);
+	return NULL;
+}
+
+/* Hands request R to V and returns without waiting for it.  A
+   flush request carries no data, so its chain skips the data
+   descriptor.  The
+   device may serve any number of requests concurrently; completion
+   is reported to disk_complete() from the interrupt handler.
+   Blocks while every slot is in flight. */
+void
+virtio_blk_submit (struct virtio_blk *v, struct disk_request *r) {
+	enum intr_level old_level;
+	struct vring_desc *d;
+	struct vblk_slot *s;
+	int slot;
+
+	if (r->flush && !v->flush) {
+		/* Write-through: nothing to flush. */
+		disk_complete (r);
+		return;
+	}
+	ASSERT (r->flush || is_kernel_vaddr (r->buffer));
+
+	sema_down (&v->slot_wait);
+	old_level = intr_disable ();
+	slot = v->free_slot;
+	ASSERT (slot >= 0);
+	s = &v->slots[slot];
+	v->free_slot = s->next_free;
+
+	s->hdr.type = r->flush ? BLK_T_FLUSH : r->write ? BLK_T_OUT : BLK_T_IN;
+	s->hdr.reserved = 0;
+	s->hdr.sector = r->sector;
+	s->status = 0xff;
+	s->req = r;
+
+	d = &v->desc[slot * DESC_PER_REQ];
+	d[0].addr = vtop (&s->hdr);
+	d[0].len = sizeof s->hdr;
+	d[0].flags = DESC_F_NEXT;
+	d[0].next = slot * DESC_PER_REQ + (r->flush ? 2 : 1);
+	if (!r->flush) {
+		d[1].addr = vtop (r->buffer);
+		d[1].len = r->sec_cnt * DISK_SECTOR_SIZE;
+		d[1].flags = DESC_F_NEXT | (r->write ? 0 : DESC_F_WRITE);
+		d[1].next = slot * DESC_PER_REQ + 2;
+	}
+	d[2].addr = vtop (&s->status);
+	d[2].len = 1;
+	d[2].flags = DESC_F_WRITE;
+	d[2].next = 0;
+
+	/* The device must see the chain before the index that
+	   publishes it, and the index before the notification. */
+	v->avail->ring[v->avail->idx % v->queue_size] = slot * DESC_PER_REQ;
+	barrier ();
+	v->avail->idx++;
+	barrier ();
+	outw (reg_queue_notify (v), 0);
+	intr_set_level (old_level);
+}
+
+/* Completes every request V has moved to its used ring. */
+static void
+complete_used (struct virtio_blk *v) {
+	while (v->used_idx != *(volatile uint16_t *) &v->used->idx) {
+		struct vring_used_elem *e;
+		struct disk_request *r;
+		struct vblk_slot *s;
+		int slot;
+
+		barrier ();
+		e = &v->used->ring[v->used_idx % v->queue_size];
+		slot = e->id / DESC_PER_REQ;
+		s = &v->slots[slot];
+		r = s->req;
+		if (s->status != BLK_S_OK)
+			PANIC ("%s: virtio %s failed, sector=%"PRDSNu, v->name,
+					r->write ? "write" : "read", r->sector);
+
+		s->next_free = v->free_slot;
+		v->free_slot = slot;
+		v->used_idx++;
+		sema_up (&v->slot_wait);
+		disk_complete (r);
+	}
+}
+
+/* virtio-blk interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f) {
+	for (int i = 0; i < VIRTIO_BLK_SLOTS; i++) {
+		struct virtio_blk *v = vblks[i];
+		if (v != NULL && f->vec_no == 0x20u + v->irq) {
+			inb (reg_isr (v));              /* Acknowledge interrupt. */
+			complete_used (v);
+		}
+	}
+}
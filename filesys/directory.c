@@ -1,10 +1,17 @@
 #include "filesys/directory.h"
+#include <dirent.h>
+#include <round.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "filesys/symlink.h"
 /* A directory. */
 struct dir {
@@ -17,8 +24,210 @@ struct dir_entry {
 	disk_sector_t inode_sector;         /* Sector number of header. */
 	char name[NAME_MAX + 1];            /* Null terminated file name. */
 	bool in_use;                        /* In use or free? */
+	uint8_t type;                       /* enum inode_status of the file. */
 };
 
+/* In-memory index of a directory's entries, built on first lookup
+ * and kept with the inode, so every opener shares it.  If it cannot
+ * be kept up to date for lack of memory it is dropped and rebuilt
+ * later; without one, lookups fall back to scanning. */
+struct dir_index {
+	struct hash names;                  /* dir_slots by name. */
+	size_t used;                        /* Entries in use. */
+	off_t *free;                        /* Offsets of free entries. */
+	size_t free_cnt, free_cap;
+};
+
+/* An in-use entry in a dir_index. */
+struct dir_slot {
+	struct hash_elem elem;
+	off_t ofs;                          /* Offset of the entry. */
+	disk_sector_t inode_sector;
+	uint8_t type;
+	char name[NAME_MAX + 1];
+};
+
+/* Directory entry cache: remembers which sector a name resolved to
+ * in a parent directory, or that it did not exist, across the
+ * parent being closed and reopened.  Direct-mapped; a colliding
+ * insert simply replaces the old entry. */
+#define DCACHE_SIZE 256
+
+struct dcache_entry {
+	disk_sector_t parent;               /* Directory's inode sector. */
+	disk_sector_t sector;               /* Child's inode sector. */
+	bool valid;                         /* Entry holds anything? */
+	bool negative;                      /* NAME known not to exist? */
+	char name[NAME_MAX + 1];
+};
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct lock dcache_lock;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void) {
+	lock_init (&dcache_lock);
+	memset (dcache, 0, sizeof dcache);
+}
+
+static struct dcache_entry *
+dcache_slot (disk_sector_t parent, const char *name) {
+	uint64_t h = hash_string (name) ^ hash_int (parent);
+	return &dcache[h % DCACHE_SIZE];
+}
+
+/* Looks up NAME in the directory at sector PARENT.  Returns 1 and
+ * sets *SECTOR on a hit, -1 if NAME is known to be absent, and 0 if
+ * the cache knows nothing. */
+static int
+dcache_get (disk_sector_t parent, const char *name, disk_sector_t *sector) {
+	int result = 0;
+
+	lock_acquire (&dcache_lock);
+	struct dcache_entry *d = dcache_slot (parent, name);
+	if (d->valid && d->parent == parent && !strcmp (d->name, name)) {
+		*sector = d->sector;
+		result = d->negative ? -1 : 1;
+	}
+	lock_release (&dcache_lock);
+	return result;
+}
+
+/* Records that NAME in PARENT resolves to SECTOR, or is absent if
+ * NEGATIVE. */
+static void
+dcache_put (disk_sector_t parent, const char *name, disk_sector_t sector,
+		bool negative) {
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	struct dcache_entry *d = dcache_slot (parent, name);
+	d->valid = true;
+	d->negative = negative;
+	d->parent = parent;
+	d->sector = sector;
+	strlcpy (d->name, name, sizeof d->name);
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every entry under the directory at sector PARENT, and any
+ * entry resolving to it.  Called when that sector is freed, so it is
+ * never mistaken for its next owner. */
+void
+dcache_purge (disk_sector_t parent) {
+	lock_acquire (&dcache_lock);
+	for (size_t i = 0; i < DCACHE_SIZE; i++)
+		if (dcache[i].parent == parent
+				|| (!dcache[i].negative && dcache[i].sector == parent))
+			dcache[i].valid = false;
+	lock_release (&dcache_lock);
+}
+
+static uint64_t
+slot_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_string (hash_entry (e, struct dir_slot, elem)->name);
+}
+
+static bool
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return strcmp (hash_entry (a, struct dir_slot, elem)->name,
+	               hash_entry (b, struct dir_slot, elem)->name) < 0;
+}
+
+static void
+slot_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct dir_slot, elem));
+}
+
+/* Frees INDEX.  Called by inode_close() and on allocation failure. */
+void
+dir_index_destroy (struct dir_index *index) {
+	if (index != NULL) {
+		hash_destroy (&index->names, slot_free);
+		free (index->free);
+		free (index);
+	}
+}
+
+/* Drops DIR's index after an allocation failure. */
+static void
+index_drop (const struct dir *dir) {
+	struct dir_index **indexp = inode_dir_index (dir->inode);
+	dir_index_destroy (*indexp);
+	*indexp = NULL;
+}
+
+/* Records that the entry at OFS is free. */
+static bool
+index_push_free (struct dir_index *index, off_t ofs) {
+	if (index->free_cnt == index->free_cap) {
+		size_t cap = index->free_cap ? index->free_cap * 2 : 16;
+		off_t *free_ = realloc (index->free, cap * sizeof *free_);
+		if (free_ == NULL)
+			return false;
+		index->free = free_;
+		index->free_cap = cap;
+	}
+	index->free[index->free_cnt++] = ofs;
+	return true;
+}
+
+/* Adds an in-use entry E at OFS to INDEX. */
+static bool
+index_insert (struct dir_index *index, const struct dir_entry *e, off_t ofs) {
+	struct dir_slot *slot = malloc (sizeof *slot);
+	if (slot == NULL)
+		return false;
+	slot->ofs = ofs;
+	slot->inode_sector = e->inode_sector;
+	slot->type = e->type;
+	strlcpy (slot->name, e->name, sizeof slot->name);
+	hash_insert (&index->names, &slot->elem);
+	index->used++;
+	return true;
+}
+
+/* Returns DIR's index, reading the whole directory a page at a time
+ * to build it if there is none yet.  Returns a null pointer if out of
+ * memory. */
+static struct dir_index *
+dir_index (const struct dir *dir) {
+	struct dir_index **indexp = inode_dir_index (dir->inode);
+	if (*indexp != NULL)
+		return *indexp;
+
+	struct dir_index *index = calloc (1, sizeof *index);
+	struct dir_entry *buf = palloc_get_page (0);
+	if (index == NULL || buf == NULL
+			|| !hash_init (&index->names, slot_hash, slot_less, NULL)) {
+		free (index);
+		palloc_free_page (buf);
+		return NULL;
+	}
+
+	const size_t per_read = PGSIZE / sizeof *buf;
+	off_t ofs = 0;
+	off_t n;
+	*indexp = index;
+	while ((n = inode_read_at (dir->inode, buf, per_read * sizeof *buf, ofs))
+			>= (off_t) sizeof *buf) {
+		for (size_t i = 0; i < n / sizeof *buf; i++, ofs += sizeof *buf) {
+			bool ok = buf[i].in_use ? index_insert (index, &buf[i], ofs)
+			                        : index_push_free (index, ofs);
+			if (!ok) {
+				index_drop (dir);
+				palloc_free_page (buf);
+				return NULL;
+			}
+		}
+	}
+	palloc_free_page (buf);
+	return index;
+}
+
 /* Opens and returns the directory for the given INODE, of which
  * it takes ownership.  Returns a null pointer on failure. */
 struct dir *
@@ -95,6 +304,25 @@ lookup (const struct dir *dir, const char *name,
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	struct dir_index *index = dir_index (dir);
+	if (index != NULL) {
+		struct dir_slot key;
+		strlcpy (key.name, name, sizeof key.name);
+		struct hash_elem *h = hash_find (&index->names, &key.elem);
+		if (h == NULL || strlen (name) > NAME_MAX)
+			return false;
+		struct dir_slot *slot = hash_entry (h, struct dir_slot, elem);
+		if (ep != NULL) {
+			ep->inode_sector = slot->inode_sector;
+			strlcpy (ep->name, slot->name, sizeof ep->name);
+			ep->in_use = true;
+			ep->type = slot->type;
+		}
+		if (ofsp != NULL)
+			*ofsp = slot->ofs;
+		return true;
+	}
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -119,22 +347,41 @@ dir_lookup (const struct dir *dir, const char *name,
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
+	/* The child is opened before the lock is dropped, so it cannot be
+	 * removed and its sector reused in between. */
+	lock_acquire (inode_dir_lock (dir->inode));
+	disk_sector_t parent = inode_get_inumber (dir->inode);
+	disk_sector_t sector;
+	switch (dcache_get (parent, name, &sector)) {
+	case 1:
+		*inode = inode_open (sector);
+		break;
+	case -1:
 		*inode = NULL;
+		break;
+	default:
+		if (lookup (dir, name, &e, NULL)) {
+			dcache_put (parent, name, e.inode_sector, false);
+			*inode = inode_open (e.inode_sector);
+		} else {
+			dcache_put (parent, name, 0, true);
+			*inode = NULL;
+		}
+	}
+	lock_release (inode_dir_lock (dir->inode));
 
 	return *inode != NULL;
 }
 
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
- * INODE_SECTOR.
+ * INODE_SECTOR and is of type TYPE.
  * Returns true if successful, false on failure.
  * Fails if NAME is invalid (i.e. too long) or a disk or memory
  * error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector,
+		enum inode_status type) {
 	struct dir_entry e;
 	off_t ofs;
 	bool success = false;
@@ -145,8 +392,9 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 	
-	/* Check that NAME is not in use. */
-	if (lookup (dir, name, NULL, NULL))
+	/* Check that DIR is still there and NAME is not in use. */
+	lock_acquire (inode_dir_lock (dir->inode));
+	if (is_inode_removed (dir->inode) || lookup (dir, name, NULL, NULL))
 		goto done;
 	
 	/* Set OFS to offset of free slot.
@@ -156,19 +404,32 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	 * inode_read_at() will only return a short read at end of file.
 	 * Otherwise, we'd need to verify that we didn't get a short
 	 * read due to something intermittent such as low memory. */
-	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-			ofs += sizeof e){
-		if (!e.in_use)
-			break;
+	struct dir_index *index = dir_index (dir);
+	if (index != NULL) {
+		ofs = index->free_cnt > 0 ? index->free[--index->free_cnt]
+		                          : inode_length (dir->inode);
+	} else {
+		for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+				ofs += sizeof e){
+			if (!e.in_use)
+				break;
+		}
 	}
 	
 	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
 	e.inode_sector = inode_sector;
+	e.type = type;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+	if (index != NULL && !(success ? index_insert (index, &e, ofs)
+	                                : index_push_free (index, ofs)))
+		index_drop (dir);
+	if (success)
+		dcache_put (inode_get_inumber (dir->inode), name, inode_sector, false);
 	//dir_entry_count_used(dir);
 done:
+	lock_release (inode_dir_lock (dir->inode));
 	return success;
 }
 
@@ -179,6 +440,7 @@ bool
 dir_remove (struct dir *dir, const char *name) {
 	struct dir_entry e;
 	struct inode *inode = NULL;
+	struct lock *target_lock = NULL;
 	bool success = false;
 	off_t ofs;
 
@@ -186,6 +448,7 @@ dir_remove (struct dir *dir, const char *name) {
 	ASSERT (name != NULL);
 
 	/* Find directory entry. */
+	lock_acquire (inode_dir_lock (dir->inode));
 	if (!lookup (dir, name, &e, &ofs))
 		goto done;
 
@@ -195,13 +458,16 @@ dir_remove (struct dir *dir, const char *name) {
 		goto done;
 
 	if(inode_get_type(inode) == DIR_INODE){
-		struct dir *targetDir = dir_open(inode);
-		if(targetDir == NULL){
-			return false;
-		}
-		if(dir_entry_count_used(targetDir) != 2){
-			dir_close(targetDir);
-			return false;
+		/* Keep the target locked from the emptiness check until it is
+		 * marked removed, so that nothing is added to it in between.
+		 * Locks are taken parent first. */
+		target_lock = inode_dir_lock (inode);
+		lock_acquire (target_lock);
+		struct dir *targetDir = dir_open(inode_reopen(inode));
+		size_t used = targetDir != NULL ? dir_entry_count_used(targetDir) : 0;
+		dir_close(targetDir);
+		if(used != 2){
+			goto done;
 		}
 	}
 
@@ -209,13 +475,27 @@ dir_remove (struct dir *dir, const char *name) {
 	e.in_use = false;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
+	struct dir_index *index = *inode_dir_index (dir->inode);
+	if (index != NULL) {
+		struct dir_slot key;
+		strlcpy (key.name, name, sizeof key.name);
+		struct hash_elem *h = hash_delete (&index->names, &key.elem);
+		slot_free (h, NULL);
+		index->used--;
+		if (!index_push_free (index, ofs))
+			index_drop (dir);
+	}
+	dcache_put (inode_get_inumber (dir->inode), name, 0, true);
 
 	/* Remove inode. */
 	inode_remove (inode);
 	success = true;
 
 done:
+	if (target_lock != NULL)
+		lock_release (target_lock);
 	inode_close (inode);
+	lock_release (inode_dir_lock (dir->inode));
 	return success;
 }
 
@@ -225,15 +505,69 @@ done:
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
+	bool found = false;
 
+	lock_acquire (inode_dir_lock (dir->inode));
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			found = true;
+			break;
 		}
 	}
-	return false;
+	lock_release (inode_dir_lock (dir->inode));
+	return found;
+}
+
+/* Packs as many of DIR's remaining entries as fit in the SIZE bytes
+ * at BUF, as struct dirent records, and advances DIR's position past
+ * them.  The directory is read a page of entries at a time.  Returns
+ * the number of bytes filled, 0 at the end of the directory, or -1 if
+ * out of memory or the next entry alone does not fit. */
+int
+dir_getdents (struct dir *dir, void *buf_, size_t size) {
+	uint8_t *buf = buf_;
+	size_t filled = 0;
+	bool full = false;
+	off_t n;
+
+	struct dir_entry *entries = palloc_get_page (0);
+	if (entries == NULL)
+		return -1;
+	const size_t per_read = PGSIZE / sizeof *entries;
+
+	lock_acquire (inode_dir_lock (dir->inode));
+	while (!full
+			&& (n = inode_read_at (dir->inode, entries,
+			                       per_read * sizeof *entries, dir->pos))
+			>= (off_t) sizeof *entries) {
+		for (size_t i = 0; i < n / sizeof *entries; i++) {
+			const struct dir_entry *e = &entries[i];
+			if (e->in_use) {
+				size_t len = strnlen (e->name, NAME_MAX);
+				size_t reclen = ROUND_UP (offsetof (struct dirent, d_name) + len + 1,
+				                          8);
+				if (filled + reclen > size) {
+					full = true;
+					break;
+				}
+				struct dirent *d = (struct dirent *) (buf + filled);
+				d->d_ino = e->inode_sector;
+				d->d_reclen = reclen;
+				d->d_type = e->type == FILE_INODE ? DT_REG
+				          : e->type == DIR_INODE ? DT_DIR
+				          : e->type == SYMLINK_INODE ? DT_LNK : DT_UNKNOWN;
+				memcpy (d->d_name, e->name, len);
+				d->d_name[len] = '\0';
+				filled += reclen;
+			}
+			dir->pos += sizeof *e;
+		}
+	}
+	lock_release (inode_dir_lock (dir->inode));
+	palloc_free_page (entries);
+	return full && filled == 0 ? -1 : (int) filled;
 }
 
 //my implement function
@@ -241,13 +575,14 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 bool
 dir_add_myself(struct dir *dir){
 	if(dir == NULL) return false;
-	return dir_add(dir, ".", inode_get_inumber(dir_get_inode(dir)));
+	return dir_add(dir, ".", inode_get_inumber(dir_get_inode(dir)), DIR_INODE);
 }
 
 bool
 dir_add_parent(struct dir *dir, struct dir *parent_dir){
 	if (dir == NULL || parent_dir == NULL) return false;
-	return dir_add(dir, "..", inode_get_inumber(dir_get_inode(parent_dir)));
+	return dir_add(dir, "..", inode_get_inumber(dir_get_inode(parent_dir)),
+	               DIR_INODE);
 }
 
 void
@@ -323,10 +658,15 @@ error:
 	return false;
 }
 
+/* Returns the number of entries in use in DIR, whose lock the caller
+ * holds. */
 size_t
 dir_entry_count_used(struct dir *dir) {
     struct dir_entry e;
     size_t count = 0;
+	struct dir_index *index = dir_index (dir);
+	if (index != NULL)
+		return index->used;
     for (off_t ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e){
 		if (e.in_use){
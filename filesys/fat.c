@@ -1,8 +1,14 @@
 #include "filesys/fat.h"
 #include "devices/disk.h"
 #include "filesys/filesys.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include <bitmap.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -12,28 +18,82 @@ struct fat_boot {
 	unsigned int sectors_per_cluster; /* Fixed to 1 */
 	unsigned int total_sectors;
 	unsigned int fat_start;
-	unsigned int fat_info_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
 	unsigned int root_dir_cluster;
 	unsigned int fat_last_clst;
 };
 
+/* Number of FAT sectors kept in memory at once. */
+#define FAT_CACHE_SLOTS 64
+
+/* A cached FAT sector.  FAT sector I is disk sector FAT_START + I. */
+struct fat_slot {
+	size_t sector;              /* FAT sector held. */
+	bool in_use;
+	bool accessed;              /* Clock reference bit. */
+};
+
 /* FAT FS */
 struct fat_fs {
 	struct fat_boot bs;
-	unsigned int *fat;
-	unsigned int *fat_info;
 	unsigned int fat_length;
 	disk_sector_t data_start;
-	cluster_t last_clst;
+	cluster_t last_clst;        /* Allocation rotor for new chains. */
 	struct lock write_lock;
+
+	/* The FAT is read on first access into a small cache
+	 * rather than at mount.  Clean sectors are evicted first; a dirty
+	 * victim is written back before its slot is reused. */
+	struct lock cache_lock;
+	struct fat_slot slots[FAT_CACHE_SLOTS];
+	uint8_t *slot_data;         /* FAT_CACHE_SLOTS sectors. */
+	uint8_t *slot_of;           /* FAT sector -> slot + 1, 0: not cached. */
+	size_t clock_hand;
+
+	/* In-memory free-space map, one bit per cluster, set if the
+	 * cluster is in use.  The bits of a FAT sector become valid the
+	 * first time it is read, as recorded in MAPPED. */
+	uint64_t *used_map;
+	size_t map_words;
+	cluster_t clst_cnt;         /* Clusters backed by the disk. */
+	struct bitmap *mapped;
+
+	/* Free clusters among those whose bits are valid, and how many
+	 * of them delayed writes have been promised by fat_reserve().
+	 * FREE_CNT never drops below RESERVED: reservations are only made
+	 * against clusters already known free, and no one else may take
+	 * them.  More of the FAT is mapped only when that falls short. */
+	size_t free_cnt;
+	size_t reserved;
+
+	/* One bit per FAT sector.  Set by fat_put(), cleared as the sector
+	 * is written back.  Dirty sectors are always cached. */
+	struct bitmap *dirty;
 };
 
+/* How often the background writer pushes dirty FAT sectors out. */
+#define FAT_SYNC_INTERVAL (TIMER_FREQ * 5)
+
+/* FAT entries per sector. */
+#define ENTRIES_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (cluster_t))
+
+/* Clusters a growing file reserves past its end when it has to start a
+ * new run, so that later appends stay contiguous. */
+#define FAT_PREALLOC 16
+
+#define MAP_BITS 64
+
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
-cluster_t find_empty_cluster(void);
+static unsigned int *cache_sector (size_t sector);
+static unsigned int get_entry (cluster_t clst);
+static void put_entry (cluster_t clst, unsigned int val);
+static cluster_t alloc_run (cluster_t prev, size_t cnt, cluster_t goal,
+                            size_t reserved);
+static bool map_free (size_t need);
+static void fat_writer (void *aux);
 
 void
 fat_init (void) {
@@ -57,55 +117,8 @@ fat_init (void) {
 
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT load failed");
-	fat_fs->fat_info = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat_info == NULL)
-		PANIC ("FAT_INFO load failed");
-
-	// Load FAT directly from the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_read = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
-	}
-
-	// Load FAT_INFO directly from the disk
-	buffer = (uint8_t *) fat_fs->fat_info;
-	bytes_read = 0;
-	bytes_left = sizeof (fat_fs->fat_info);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_info_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_info_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
-	}
+	/* Nothing is read here: FAT sectors come in on first use. */
+	thread_create ("fat-writer", PRI_DEFAULT, fat_writer, NULL);
 }
 
 void
@@ -119,52 +132,9 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
-
-	// Write FAT directly to the disk
-	buffer = (uint8_t *) fat_fs->fat_info;
-	bytes_wrote = 0;
-	bytes_left = sizeof (fat_fs->fat_info);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_info_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_info_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
-	}
-
-	// free (fat_fs->fat);
-	// free (fat_fs->fat_info);
-  	//free (fat_fs);
+	// Write what changed since the last sync, and commit it before
+	// anything written after it.
+	fat_sync ();
 }
 
 void
@@ -173,17 +143,26 @@ fat_create (void) {
 	fat_boot_create ();
 	fat_fs_init ();
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat == NULL)
-		PANIC ("FAT creation failed");
-	fat_fs->fat_info = calloc (fat_fs->fat_length, sizeof (cluster_t));
-	if (fat_fs->fat_info == NULL)
+	// Create FAT table: zero it on disk, so that every sector is
+	// known free without reading it back.
+	uint8_t *zeros = palloc_get_page (PAL_ZERO);
+	if (zeros == NULL)
 		PANIC ("FAT creation failed");
+	struct disk_batch batch;
+	size_t table_sectors = fat_fs->bs.fat_sectors;
+	size_t step = PGSIZE / DISK_SECTOR_SIZE;
+	disk_batch_init (&batch);
+	for (size_t i = 0; i < table_sectors; i += step)
+		disk_batch_add (&batch, filesys_disk, fat_fs->bs.fat_start + i,
+		                table_sectors - i < step ? table_sectors - i : step,
+		                zeros, true);
+	disk_batch_wait (&batch);
+	palloc_free_page (zeros);
+	bitmap_set_all (fat_fs->mapped, true);
+	fat_fs->free_cnt = fat_fs->clst_cnt - 1;
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
-	fat_info_put(ROOT_DIR_CLUSTER, 0);
 	
 	// Fill up ROOT_DIR_CLUSTER region with 0
 	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
@@ -204,7 +183,6 @@ fat_boot_create (void) {
 	    .sectors_per_cluster = SECTORS_PER_CLUSTER,
 	    .total_sectors = disk_size (filesys_disk),
 	    .fat_start = 1,
-		.fat_info_start = 1 + fat_sectors,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
 		.fat_last_clst = ROOT_DIR_CLUSTER + 1,
@@ -216,9 +194,43 @@ fat_fs_init (void) {
 	/* TODO: Your code goes here. */
 	struct fat_boot *bs = &fat_fs->bs;
 	fat_fs->fat_length = bs->fat_sectors * (DISK_SECTOR_SIZE / sizeof (cluster_t));
-	fat_fs->data_start = bs->fat_info_start + bs->fat_sectors;
+	fat_fs->data_start = bs->fat_start + bs->fat_sectors;
 	fat_fs->last_clst = bs->fat_last_clst;
 	lock_init(&fat_fs->write_lock);
+	lock_init(&fat_fs->cache_lock);
+
+	size_t table_sectors = bs->fat_sectors;
+	free (fat_fs->slot_data);
+	free (fat_fs->slot_of);
+	bitmap_destroy (fat_fs->dirty);
+	bitmap_destroy (fat_fs->mapped);
+	memset (fat_fs->slots, 0, sizeof fat_fs->slots);
+	fat_fs->clock_hand = 0;
+	fat_fs->slot_data = malloc (FAT_CACHE_SLOTS * DISK_SECTOR_SIZE);
+	fat_fs->slot_of = calloc (table_sectors, 1);
+	fat_fs->dirty = bitmap_create (table_sectors);
+	fat_fs->mapped = bitmap_create (table_sectors);
+	if (fat_fs->slot_data == NULL || fat_fs->slot_of == NULL
+			|| fat_fs->dirty == NULL || fat_fs->mapped == NULL)
+		PANIC ("FAT cache allocation failed");
+
+	/* Until a FAT sector is mapped its clusters' bits are meaningless;
+	 * cluster 0 and the padding past the last cluster stay set. */
+	cluster_t clst_cnt = bs->total_sectors - fat_fs->data_start
+	                     + ROOT_DIR_CLUSTER;
+	if (clst_cnt > fat_fs->fat_length)
+		clst_cnt = fat_fs->fat_length;
+	free (fat_fs->used_map);
+	fat_fs->clst_cnt = clst_cnt;
+	fat_fs->map_words = DIV_ROUND_UP (clst_cnt, MAP_BITS);
+	fat_fs->used_map = calloc (fat_fs->map_words, sizeof (uint64_t));
+	if (fat_fs->used_map == NULL)
+		PANIC ("FAT free map allocation failed");
+	fat_fs->used_map[0] |= 1;
+	fat_fs->free_cnt = 0;
+	fat_fs->reserved = 0;
+	for (cluster_t c = clst_cnt; c < fat_fs->map_words * MAP_BITS; c++)
+		fat_fs->used_map[c / MAP_BITS] |= 1ULL << (c % MAP_BITS);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -229,24 +241,58 @@ fat_fs_init (void) {
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
-fat_create_chain (cluster_t clst, uint32_t file_idx) {
-	/* TODO: Your code goes here. */
-	cluster_t result = 0;
+fat_create_chain (cluster_t clst) {
+	return fat_create_run (clst, 1, 0, 0);
+}
 
-	lock_acquire(&fat_fs->write_lock);
-	if(clst != 0){
-		fat_put(clst, fat_fs->last_clst);
-	}
-	fat_put(fat_fs->last_clst, EOChain);
-	fat_info_put(fat_fs->last_clst, file_idx);
-	result = fat_fs->last_clst;
-	
-	fat_fs->last_clst = find_empty_cluster();
+/* Appends CNT clusters after CLST (0: start a new chain) and returns
+ * the last one.  The clusters are
+ * taken as one contiguous run from GOAL when free space allows; GOAL 0
+ * means the cluster after CLST, or the allocation rotor for a new
+ * chain.  Up to RESERVED of them come out of the caller's
+ * fat_reserve() reservation, which shrinks by that much on success.
+ * Returns 0, allocating nothing, if the disk is too full. */
+cluster_t
+fat_create_run (cluster_t clst, size_t cnt, cluster_t goal,
+                size_t reserved) {
+	cluster_t result;
 
+	ASSERT (cnt > 0);
+	lock_acquire(&fat_fs->write_lock);
+	result = alloc_run (clst, cnt, goal, reserved);
 	lock_release(&fat_fs->write_lock);
 	return result;
 }
 
+/* Sets CNT free clusters aside for a later fat_create_run() by the
+ * caller, so that data accepted now can still be allocated then.
+ * Further FAT sectors are read only if those mapped so far do not
+ * hold enough free clusters.  Returns false, reserving nothing, if
+ * there is not enough free space beyond what is already reserved. */
+bool
+fat_reserve (size_t cnt) {
+	bool success;
+
+	lock_acquire (&fat_fs->write_lock);
+	lock_acquire (&fat_fs->cache_lock);
+	success = map_free (fat_fs->reserved + cnt);
+	if (success)
+		fat_fs->reserved += cnt;
+	lock_release (&fat_fs->cache_lock);
+	lock_release (&fat_fs->write_lock);
+	return success;
+}
+
+/* Gives back CNT clusters of a fat_reserve() reservation that will
+ * not be allocated after all. */
+void
+fat_unreserve (size_t cnt) {
+	lock_acquire (&fat_fs->write_lock);
+	ASSERT (fat_fs->reserved >= cnt);
+	fat_fs->reserved -= cnt;
+	lock_release (&fat_fs->write_lock);
+}
+
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
@@ -258,39 +304,67 @@ fat_remove_chain (cluster_t clst, cluster_t pclst) {
 
 	cluster_t clst_ = clst;
 	cluster_t nclst_;
-	cluster_t minClst = fat_fs->last_clst;
 
 	lock_acquire(&fat_fs->write_lock);
 	if(pclst != 0){
 		fat_put(pclst, EOChain);
 	}
 
+	/* The rotor is left alone: the freed clusters are found again
+	 * through the map without rescanning the full region before them. */
 	while(clst_ != EOChain){
 		nclst_ = fat_get(clst_);
 		fat_put(clst_, 0);
-		fat_info_put(clst_, 0);
-		if(clst_ < minClst){
-			minClst = clst_;
-		}
 		clst_ = nclst_;
 	}
-
-	fat_fs->last_clst = minClst;
 	lock_release(&fat_fs->write_lock);
 }
 
+/* Writes the dirty FAT sectors to the disk and flushes
+ * the drive's write cache behind them.  The sectors are queued
+ * together, so the disk layer merges neighbours into one command. */
+void
+fat_sync (void) {
+	size_t table_sectors = fat_fs->bs.fat_sectors;
+	size_t written = 0;
+	struct disk_batch batch;
+
+	lock_acquire (&fat_fs->cache_lock);
+	disk_batch_init (&batch);
+	for (size_t i = bitmap_scan (fat_fs->dirty, 0, 1, true);
+			i != BITMAP_ERROR && i < table_sectors;
+			i = bitmap_scan (fat_fs->dirty, i + 1, 1, true)) {
+		size_t slot = fat_fs->slot_of[i] - 1;
+		ASSERT (fat_fs->slot_of[i] != 0);
+		bitmap_reset (fat_fs->dirty, i);
+		disk_batch_add (&batch, filesys_disk, fat_fs->bs.fat_start + i, 1,
+		                fat_fs->slot_data + slot * DISK_SECTOR_SIZE, true);
+		written++;
+	}
+	disk_batch_wait (&batch);
+	lock_release (&fat_fs->cache_lock);
+
+	if (written > 0)
+		disk_flush (filesys_disk);
+}
+
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
 	/* TODO: Your code goes here. */
-	fat_fs->fat[clst] = val;
+	lock_acquire (&fat_fs->cache_lock);
+	put_entry (clst, val);
+	lock_release (&fat_fs->cache_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
 	/* TODO: Your code goes here. */
-	return fat_fs->fat[clst];
+	lock_acquire (&fat_fs->cache_lock);
+	cluster_t val = get_entry (clst);
+	lock_release (&fat_fs->cache_lock);
+	return val;
 }
 
 /* Covert a cluster # to a sector number. */
@@ -302,41 +376,315 @@ cluster_to_sector (cluster_t clst) {
 
 
 // my implement funcions
+/* Inserts a new cluster right after CLST, as close to GOAL as
+ * possible (0: the cluster after CLST). */
 cluster_t
-find_empty_cluster(void){
-	cluster_t idx = fat_fs->last_clst;
+fat_insert_chain(cluster_t clst, cluster_t goal){
+	lock_acquire(&fat_fs->write_lock);
+	cluster_t end_clst = fat_get(clst);
+	cluster_t insert_clst = alloc_run(clst, 1, goal, 0);
+	if(insert_clst != 0){
+		fat_put(insert_clst, end_clst);
+	}
+	lock_release(&fat_fs->write_lock);
+	return insert_clst;
+}
 
-	while(idx < fat_fs->fat_length){
-		if(fat_fs->fat[idx] == 0){
-			return idx;
-		}
-		idx++;
+/* Frees the CNT clusters starting at CLST, which follows PCLST in
+ * its chain (0: CLST starts the chain), and links PCLST to the
+ * cluster after them.  Returns that cluster, EOChain if the run ended
+ * the chain. */
+cluster_t
+fat_remove_run(cluster_t pclst, cluster_t clst, size_t cnt){
+	lock_acquire(&fat_fs->write_lock);
+	while(cnt-- > 0 && clst != EOChain){
+		cluster_t next = fat_get(clst);
+		fat_put(clst, 0);
+		clst = next;
 	}
-	return 0;
+	if(pclst != 0){
+		fat_put(pclst, clst);
+	}
+	lock_release(&fat_fs->write_lock);
+	return clst;
 }
 
-void
-fat_info_put (cluster_t clst, uint32_t val) {
+cluster_t
+sector_to_cluster (disk_sector_t sector) {
 	/* TODO: Your code goes here. */
-	fat_fs->fat_info[clst] = val;
+	return sector - fat_fs->data_start + ROOT_DIR_CLUSTER;
 }
 
-uint32_t
-fat_info_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
-	return fat_fs->fat_info[clst];
+/* Picks a cache slot for a new sector by clock, passing over dirty
+ * sectors and recently used ones.  If every slot is dirty the one under
+ * the hand is written back. */
+static size_t
+evict_slot (void) {
+	ASSERT (lock_held_by_current_thread (&fat_fs->cache_lock));
+
+	for (size_t i = 0; ; i++) {
+		size_t slot = fat_fs->clock_hand;
+		struct fat_slot *s = &fat_fs->slots[slot];
+		fat_fs->clock_hand = (slot + 1) % FAT_CACHE_SLOTS;
+
+		if (!s->in_use)
+			return slot;
+		if (i < 2 * FAT_CACHE_SLOTS) {
+			if (bitmap_test (fat_fs->dirty, s->sector))
+				continue;
+			if (s->accessed) {
+				s->accessed = false;
+				continue;
+			}
+		} else if (bitmap_test (fat_fs->dirty, s->sector)) {
+			disk_write (filesys_disk, fat_fs->bs.fat_start + s->sector,
+			            fat_fs->slot_data + slot * DISK_SECTOR_SIZE);
+			bitmap_reset (fat_fs->dirty, s->sector);
+		}
+		fat_fs->slot_of[s->sector] = 0;
+		s->in_use = false;
+		return slot;
+	}
 }
 
-cluster_t
-fat_insert_chain(cluster_t clst, uint32_t file_idx){
-	cluster_t end_clst = fat_get(clst);
-	cluster_t insert_clst = fat_create_chain(clst, file_idx);
-	fat_put(insert_clst, end_clst);
-	return insert_clst;
+/* Returns the cached contents of FAT sector SECTOR, reading it in if
+ * needed.  A sector read for the first time also fills in its
+ * clusters' bits in USED_MAP. */
+static unsigned int *
+cache_sector (size_t sector) {
+	ASSERT (lock_held_by_current_thread (&fat_fs->cache_lock));
+	ASSERT (sector < fat_fs->bs.fat_sectors);
+
+	size_t slot;
+	if (fat_fs->slot_of[sector] != 0) {
+		slot = fat_fs->slot_of[sector] - 1;
+		fat_fs->slots[slot].accessed = true;
+		return (unsigned int *) (fat_fs->slot_data + slot * DISK_SECTOR_SIZE);
+	}
+
+	slot = evict_slot ();
+	unsigned int *data =
+		(unsigned int *) (fat_fs->slot_data + slot * DISK_SECTOR_SIZE);
+	disk_read (filesys_disk, fat_fs->bs.fat_start + sector, data);
+	fat_fs->slots[slot] = (struct fat_slot) {
+		.sector = sector,
+		.in_use = true,
+		.accessed = true,
+	};
+	fat_fs->slot_of[sector] = slot + 1;
+
+	if (!bitmap_test (fat_fs->mapped, sector)) {
+		for (size_t i = 0; i < ENTRIES_PER_SECTOR; i++) {
+			cluster_t c = sector * ENTRIES_PER_SECTOR + i;
+			if (c == 0 || c >= fat_fs->clst_cnt)
+				continue;
+			if (data[i] != 0)
+				fat_fs->used_map[c / MAP_BITS] |= 1ULL << (c % MAP_BITS);
+			else {
+				fat_fs->used_map[c / MAP_BITS] &= ~(1ULL << (c % MAP_BITS));
+				fat_fs->free_cnt++;
+			}
+		}
+		bitmap_mark (fat_fs->mapped, sector);
+	}
+	return data;
 }
 
-cluster_t
-sector_to_cluster (disk_sector_t sector) {
-	/* TODO: Your code goes here. */
-	return sector - fat_fs->data_start + ROOT_DIR_CLUSTER;
-}
\ No newline at end of file
+/* Returns FAT entry CLST. */
+static unsigned int
+get_entry (cluster_t clst) {
+	return cache_sector (clst / ENTRIES_PER_SECTOR)[clst % ENTRIES_PER_SECTOR];
+}
+
+/* Sets FAT entry CLST to VAL, keeping USED_MAP and FREE_CNT in
+ * step. */
+static void
+put_entry (cluster_t clst, unsigned int val) {
+	size_t sector = clst / ENTRIES_PER_SECTOR;
+	cache_sector (sector)[clst % ENTRIES_PER_SECTOR] = val;
+	bitmap_mark (fat_fs->dirty, sector);
+
+	if (clst != 0 && clst < fat_fs->clst_cnt) {
+		uint64_t *word = &fat_fs->used_map[clst / MAP_BITS];
+		uint64_t bit = 1ULL << (clst % MAP_BITS);
+		if (val != 0 && (*word & bit) == 0) {
+			*word |= bit;
+			fat_fs->free_cnt--;
+		} else if (val == 0 && (*word & bit) != 0) {
+			*word &= ~bit;
+			fat_fs->free_cnt++;
+		}
+	}
+}
+
+/* Reads unmapped FAT sectors until NEED clusters are known free or
+ * the whole FAT is mapped.  Returns whether NEED was reached. */
+static bool
+map_free (size_t need) {
+	size_t sector = 0;
+
+	while (fat_fs->free_cnt < need) {
+		sector = bitmap_scan (fat_fs->mapped, sector, 1, false);
+		if (sector == BITMAP_ERROR)
+			return false;
+		cache_sector (sector);
+	}
+	return true;
+}
+
+/* Makes sure USED_MAP word W reflects the FAT. */
+static void
+map_word (size_t w) {
+	size_t sector = w * MAP_BITS / ENTRIES_PER_SECTOR;
+	if (!bitmap_test (fat_fs->mapped, sector))
+		cache_sector (sector);
+}
+
+/* Returns the first cluster at or after FROM whose bit equals USED,
+ * or CLST_CNT if there is none.  Whole words of the other value are
+ * skipped at once. */
+static cluster_t
+find_bit (cluster_t from, bool used) {
+	uint64_t flip = used ? 0 : ~0ULL;
+	size_t w = from / MAP_BITS;
+	uint64_t word;
+
+	if (w >= fat_fs->map_words)
+		return fat_fs->clst_cnt;
+	map_word (w);
+	word = (fat_fs->used_map[w] ^ flip) & (~0ULL << (from % MAP_BITS));
+	while (word == 0) {
+		if (++w == fat_fs->map_words)
+			return fat_fs->clst_cnt;
+		map_word (w);
+		word = fat_fs->used_map[w] ^ flip;
+	}
+	from = w * MAP_BITS + __builtin_ctzll (word);
+	return from < fat_fs->clst_cnt ? from : fat_fs->clst_cnt;
+}
+
+/* Finds a run of free clusters for an allocation that would like WANT
+ * of them, searching from GOAL and wrapping around once.  Returns the
+ * first free run at least WANT long, or else the longest one seen, and
+ * stores its length in *LEN. */
+static cluster_t
+find_run (cluster_t goal, size_t want, size_t *len) {
+	cluster_t best = 0;
+	size_t best_len = 0;
+	bool wrapped = false;
+	cluster_t c = goal;
+
+	for (;;) {
+		c = find_bit (c, false);
+		if (c >= fat_fs->clst_cnt || (wrapped && c >= goal)) {
+			if (wrapped)
+				break;
+			wrapped = true;
+			c = 0;
+			continue;
+		}
+
+		cluster_t end = find_bit (c, true);
+		if (end - c >= want) {
+			best = c;
+			best_len = end - c;
+			break;
+		}
+		if (end - c > best_len) {
+			best = c;
+			best_len = end - c;
+		}
+		c = end;
+	}
+	*len = best_len;
+	return best;
+}
+
+/* Does the work of fat_create_run() with write_lock held.  An extended
+ * chain that has to move to a new run looks for FAT_PREALLOC clusters
+ * beyond its need and pushes the rotor past them, so that new chains do
+ * not land in the file's way.  Free space is only known for the part of
+ * the FAT read so far, so running out is found midway and undone.
+ * RESERVED of the clusters may come from the caller's reservation;
+ * the rest must leave everyone else's reservations intact. */
+static cluster_t
+alloc_run (cluster_t prev, size_t cnt, cluster_t goal, size_t reserved) {
+	ASSERT (lock_held_by_current_thread (&fat_fs->write_lock));
+
+	cluster_t first_prev = prev;
+	cluster_t first = 0;
+	cluster_t old_next = 0;
+	size_t done = 0;
+
+	if (reserved > cnt)
+		reserved = cnt;
+	ASSERT (fat_fs->reserved >= reserved);
+	lock_acquire (&fat_fs->cache_lock);
+	if (prev != 0)
+		old_next = get_entry (prev);
+	/* Leave the clusters reserved by others alone. */
+	if (fat_fs->reserved > 0
+			&& !map_free (fat_fs->reserved - reserved + cnt))
+		goto full;
+	if (goal == 0 || goal >= fat_fs->clst_cnt)
+		goal = prev != 0 ? prev + 1 : fat_fs->last_clst;
+	if (goal >= fat_fs->clst_cnt)
+		goal = ROOT_DIR_CLUSTER + 1;
+
+	while (done < cnt) {
+		size_t left = cnt - done;
+		size_t want = prev != 0 && left < FAT_PREALLOC ? FAT_PREALLOC : left;
+		cluster_t start = goal;
+		size_t len, window;
+
+		if (find_bit (goal, false) == goal) {
+			/* Continue in place. */
+			len = find_bit (goal, true) - goal;
+			window = len < left ? len : left;
+		} else {
+			start = find_run (goal, want, &len);
+			window = len < want ? len : want;
+		}
+		if (len == 0)
+			goto full;
+
+		size_t n = len < left ? len : left;
+		for (size_t i = 0; i < n; i++) {
+			if (prev != 0)
+				put_entry (prev, start + i);
+			put_entry (start + i, EOChain);
+			prev = start + i;
+		}
+		if (first == 0)
+			first = start;
+		if (fat_fs->last_clst >= start && fat_fs->last_clst < start + window)
+			fat_fs->last_clst = start + window;
+		done += n;
+		goal = prev + 1;
+	}
+	fat_fs->reserved -= reserved;
+	lock_release (&fat_fs->cache_lock);
+	return prev;
+
+full:
+	/* Give back what this call took. */
+	if (first_prev != 0)
+		put_entry (first_prev, old_next);
+	for (cluster_t c = first; done-- > 0; ) {
+		cluster_t next = get_entry (c);
+		put_entry (c, 0);
+		c = next;
+	}
+	lock_release (&fat_fs->cache_lock);
+	return 0;
+}
+
+/* Background writer: syncs the FAT every FAT_SYNC_INTERVAL ticks so a
+ * crash loses at most that much allocation state. */
+static void
+fat_writer (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FAT_SYNC_INTERVAL);
+		fat_sync ();
+	}
+}
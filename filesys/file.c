@@ -9,6 +9,7 @@ struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	struct readahead ra;        /* Sequential access detection. */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -72,6 +73,7 @@ file_get_inode (struct file *file) {
  * Advances FILE's position by the number of bytes read. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
+	inode_readahead (file->inode, &file->ra, file->pos, size);
 	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_read;
 	return bytes_read;
@@ -84,6 +86,7 @@ file_read (struct file *file, void *buffer, off_t size) {
  * The file's current position is unaffected. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
+	inode_readahead (file->inode, &file->ra, file_ofs, size);
 	return inode_read_at (file->inode, buffer, size, file_ofs);
 }
 
@@ -165,4 +168,20 @@ file_tell (struct file *file) {
 bool
 file_create (disk_sector_t sector, off_t initial_size) {
 	return inode_create (sector, initial_size, FILE_INODE);
+}
+
+/* Reserves space for bytes OFFSET up to OFFSET + LEN of FILE without
+ * writing it, extending FILE if needed.  Returns true if successful. */
+bool
+file_fallocate (struct file *file, off_t offset, off_t len) {
+	ASSERT (file != NULL);
+	return inode_fallocate (file->inode, offset, len);
+}
+
+/* Frees the space behind bytes OFFSET up to OFFSET + LEN of FILE,
+ * which then read as zeros.  Returns true if successful. */
+bool
+file_punch_hole (struct file *file, off_t offset, off_t len) {
+	ASSERT (file != NULL);
+	return inode_punch_hole (file->inode, offset, len);
 }
\ No newline at end of file
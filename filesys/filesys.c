@@ -27,6 +27,7 @@ filesys_init (bool format) {
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
 	inode_init ();
+	dcache_init ();
 #ifdef EFILESYS
 	fat_init ();
 
@@ -55,6 +56,7 @@ filesys_done (void) {
 #else
 	free_map_close ();
 #endif
+	disk_flush (filesys_disk);
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -91,7 +93,7 @@ filesys_create (const char *name, off_t initial_size, enum inode_status f_d_s, v
 	}
 	
 	cluster_t clst;
-	clst = fat_create_chain(0, 0);
+	clst = fat_create_chain(0);
 	disk_sector_t inode_sector = cluster_to_sector(clst);
 	success = curDir != NULL && clst != 0;
 	if (!success){
@@ -112,7 +114,7 @@ filesys_create (const char *name, off_t initial_size, enum inode_status f_d_s, v
 		success = false;
 		goto done;
 	}
-    success = success && dir_add (curDir, file_name, inode_sector);
+    success = success && dir_add (curDir, file_name, inode_sector, f_d_s);
 	
 	if (!success)
 		fat_remove_chain(clst, 0);
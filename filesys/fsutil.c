@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,14 +16,23 @@
 void
 fsutil_ls (char **argv UNUSED) {
 	struct dir *dir;
-	char name[NAME_MAX + 1];
+	char *buf;
+	int n;
 
 	printf ("Files in the root directory:\n");
 	dir = dir_open_root ();
 	if (dir == NULL)
 		PANIC ("root dir open failed");
-	while (dir_readdir (dir, name))
-		printf ("%s\n", name);
+	buf = palloc_get_page (PAL_ASSERT);
+	while ((n = dir_getdents (dir, buf, PGSIZE)) > 0) {
+		struct dirent *d;
+		for (int ofs = 0; ofs < n; ofs += d->d_reclen) {
+			d = (struct dirent *) (buf + ofs);
+			printf ("%s\n", d->d_name);
+		}
+	}
+	palloc_free_page (buf);
+	dir_close (dir);
 	printf ("End of listing.\n");
 }
 
@@ -3,17 +3,67 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "filesys/fat.h"
 #include "lib/kernel/hash.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Readahead window bounds, in sectors.  A sequential reader starts at
+ * RA_MIN sectors ahead and doubles on every further sequential read. */
+#define RA_MIN 4
+#define RA_MAX 64
+
+/* Sectors held by the readahead cache. */
+#define RA_SLOTS 128
+
+/* A sector prefetched by readahead. */
+struct ra_slot {
+	disk_sector_t sector;
+	enum { RA_EMPTY, RA_PENDING, RA_READY } state;
+	bool accessed;              /* Clock reference bit. */
+	struct disk_request req;    /* Read in flight while RA_PENDING. */
+	struct semaphore ready;     /* Up'd when the read completes. */
+	uint8_t *data;
+};
+
+/* Readahead cache.  Slots are filled asynchronously and consumed by
+ * inode_read_at(); writes through inode_write_at() and inode_create()
+ * invalidate the sectors they touch. */
+static struct ra_slot ra_slots[RA_SLOTS];
+static struct lock ra_lock;
+static size_t ra_hand;
+
+/* A run of allocated file sectors: sectors START .. START + CNT - 1
+ * are held, in order, by consecutive clusters of the file's chain.
+ * Sectors between extents are holes that read as zeros.  So do the
+ * sectors of an unwritten extent, whose clusters were reserved but
+ * never written, until a write turns them into ordinary ones. */
+struct inode_extent {
+	uint32_t start;
+	uint32_t cnt : 31;
+	uint32_t unwritten : 1;
+};
+
+/* Extents kept in the inode itself; the rest go to overflow blocks. */
+#define INLINE_EXTENTS 60
+#define EXTENTS_PER_BLOCK (DISK_SECTOR_SIZE / sizeof (struct inode_extent))
+
+/* Bytes of data an inline inode keeps in the space of its extents. */
+#define INLINE_BYTES (INLINE_EXTENTS * sizeof (struct inode_extent))
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * An inode with no extents is inline: it has no clusters, and its
+ * data, up to INLINE_BYTES of it, is kept where the extents would
+ * be. */
 struct inode_disk {
 	disk_sector_t start;                /* First data sector. */
 	cluster_t clst;
@@ -21,7 +71,12 @@ struct inode_disk {
 	off_t length;                       /* File size in bytes. */
 	int f_d_s;
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[122];               /* Not used. */
+	uint32_t ext_cnt;                   /* Number of extents. */
+	cluster_t ext_overflow;             /* Overflow block chain, 0: none. */
+	union {
+		struct inode_extent extents[INLINE_EXTENTS]; /* In file order. */
+		uint8_t inline_data[INLINE_BYTES];  /* Data of an inline inode. */
+	};
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,57 +86,369 @@ bytes_to_sectors (off_t size) {
 	return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* What open_inodes hashes on.  Kept apart from the rest of the
+ * inode so that a lookup does not need a whole inode on the stack. */
+struct inode_key {
+	struct hash_elem elem;              /* Element in open_inodes. */
+	disk_sector_t sector;               /* Sector number of disk location. */
+};
+
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
-	disk_sector_t sector;               /* Sector number of disk location. */
+	struct inode_key key;               /* Open inode table entry. */
 	int open_cnt;                       /* Number of openers. */
 	bool removed;                       /* True if deleted, false otherwise. */
+
+	/* Opening and closing state, guarded by open_inodes_lock.  The
+	 * table is not locked while an inode is read in or written back;
+	 * the inode stays in the table meanwhile, and openers that find
+	 * it wait on LOADED instead. */
+	enum { INODE_LOADING, INODE_READY, INODE_FAILED } state;
+	struct condition loaded;            /* Signaled when STATE leaves LOADING. */
+	bool closing;                       /* Last closer is writing it back. */
+	bool reopened;                      /* Opened again while CLOSING. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+
+	/* Held shared to read the data and extents, exclusive to write,
+	 * grow, or change deny_write_cnt. */
+	struct rwlock rw;
+	struct inode_extent *overflow;      /* Extents past INLINE_EXTENTS. */
+	size_t overflow_cap;                /* Slots in OVERFLOW. */
+
+	/* Delayed allocation.  Data written past the last allocated sector
+	 * is held in DELAY_BUF, a page mirroring the file from DELAY_START
+	 * on, and the length change stays in memory.  Clusters are
+	 * allocated and the data written when the page is flushed.  The
+	 * DELAY_RESERVED clusters the flush needs are reserved with
+	 * fat_reserve() as the data comes in, so that it cannot fail for
+	 * lack of space. */
+	uint8_t *delay_buf;
+	off_t delay_start;
+	size_t delay_reserved;
+
+	struct dir_index *dir_index;        /* Name index of a directory. */
+	struct lock dir_lock;               /* Serializes directory changes. */
 };
 
+/* Bytes of appended data one inode holds before allocating. */
+#define DELAY_BYTES PGSIZE
+
+static disk_sector_t fill_hole (struct inode *, size_t ext_idx,
+                                uint32_t target, size_t pos);
+static void inode_store (struct inode *);
+static void inode_flush_delayed (struct inode *);
+static bool alloc_tail (struct inode *, size_t first_idx, size_t end_idx,
+                        bool unwritten, size_t reserved);
+static bool delay_admit (struct inode *, off_t delay_start, off_t new_size);
+static bool inline_migrate (struct inode *);
+static void ext_mark_written (struct inode *, off_t from, off_t to);
+
+/* Returns true if INODE keeps its data in its own sector. */
+static inline bool
+is_inline (const struct inode *inode) {
+	return inode->data.ext_cnt == 0;
+}
+
+/* Returns extent I of INODE. */
+static struct inode_extent *
+ext_at (struct inode *inode, size_t i) {
+	ASSERT (i < INLINE_EXTENTS + inode->overflow_cap);
+	return i < INLINE_EXTENTS ? &inode->data.extents[i]
+	                          : &inode->overflow[i - INLINE_EXTENTS];
+}
+
+/* Makes room for N more extents in INODE.  Returns false if out of
+ * memory. */
+static bool
+ext_reserve (struct inode *inode, size_t n) {
+	size_t need = inode->data.ext_cnt + n;
+	if (need <= INLINE_EXTENTS + inode->overflow_cap)
+		return true;
+
+	size_t cap = inode->overflow_cap
+	             + DIV_ROUND_UP (need - INLINE_EXTENTS - inode->overflow_cap,
+	                             EXTENTS_PER_BLOCK) * EXTENTS_PER_BLOCK;
+	struct inode_extent *overflow =
+		realloc (inode->overflow, cap * sizeof *overflow);
+	if (overflow == NULL)
+		return false;
+	memset (overflow + inode->overflow_cap, 0,
+	        (cap - inode->overflow_cap) * sizeof *overflow);
+	inode->overflow = overflow;
+	inode->overflow_cap = cap;
+	return true;
+}
+
+/* Inserts E as extent I of INODE, which must have room for it. */
+static void
+ext_insert (struct inode *inode, size_t i, struct inode_extent e) {
+	ASSERT (inode->data.ext_cnt < INLINE_EXTENTS + inode->overflow_cap);
+	for (size_t j = inode->data.ext_cnt++; j > i; j--)
+		*ext_at (inode, j) = *ext_at (inode, j - 1);
+	*ext_at (inode, i) = e;
+}
+
+/* Removes extent I of INODE. */
+static void
+ext_remove (struct inode *inode, size_t i) {
+	for (size_t j = i + 1; j < inode->data.ext_cnt; j++)
+		*ext_at (inode, j - 1) = *ext_at (inode, j);
+	inode->data.ext_cnt--;
+}
+
+/* Merges extent I of INODE with its neighbours where they continue it
+ * with the same kind of sectors. */
+static void
+ext_merge (struct inode *inode, size_t i) {
+	struct inode_extent *e = ext_at (inode, i);
+	if (i + 1 < inode->data.ext_cnt) {
+		struct inode_extent *next = ext_at (inode, i + 1);
+		if (next->start == e->start + e->cnt
+				&& next->unwritten == e->unwritten) {
+			e->cnt += next->cnt;
+			ext_remove (inode, i + 1);
+		}
+	}
+	if (i > 0) {
+		struct inode_extent *prev = ext_at (inode, i - 1);
+		if (prev->start + prev->cnt == e->start
+				&& prev->unwritten == e->unwritten) {
+			prev->cnt += e->cnt;
+			ext_remove (inode, i);
+		}
+	}
+}
+
+/* Returns the byte offset just past INODE's last allocated sector. */
+static off_t
+alloc_end (struct inode *inode) {
+	struct inode_extent *last = ext_at (inode, inode->data.ext_cnt - 1);
+	return (off_t) (last->start + last->cnt) * DISK_SECTOR_SIZE;
+}
+
+/* Returns the cluster N places down the chain from CLST, or 0 if the
+ * chain is shorter. */
+static cluster_t
+chain_nth (cluster_t clst, size_t n) {
+	while (n-- > 0) {
+		clst = fat_get (clst);
+		if (clst == EOChain)
+			return 0;
+	}
+	return clst;
+}
+
 /* Returns the disk sector that contains byte offset POS within
  * INODE.
  * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * POS, and -2 if POS falls in a hole or an unwritten extent and
+ * DO_ALLOC is false. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos, bool do_alloc) {
+byte_to_sector (struct inode *inode, off_t pos, bool do_alloc) {
 	ASSERT (inode != NULL);
 	if (pos < inode->data.length){
-		cluster_t clst = inode->data.clst;
-		size_t target = pos / DISK_SECTOR_SIZE;
-		cluster_t pclst = inode->data.clst;
-		for(int i=0; i<pos / DISK_SECTOR_SIZE; i++){
-			if(fat_info_get(clst) == target){
-				return cluster_to_sector(clst);
-			} else if( fat_info_get(clst) > target){
-				
-				if(!do_alloc){
+		uint32_t target = pos / DISK_SECTOR_SIZE;
+		size_t chain_pos = 0;
+		size_t i;
+		for(i = 0; i < inode->data.ext_cnt; i++){
+			struct inode_extent *e = ext_at(inode, i);
+			if(target < e->start){
+				break;
+			}
+			if(target < e->start + e->cnt){
+				if(e->unwritten && !do_alloc){
 					return -2;
-				} else{
-					return inode_fill_lazy_clst(pclst, target);
 				}
+				cluster_t clst = chain_nth(inode->data.clst,
+				                           chain_pos + target - e->start);
+				return clst != 0 ? cluster_to_sector(clst) : (disk_sector_t) -1;
 			}
-			pclst = clst;
-			clst = fat_get(clst);
-			if(clst == EOChain){
-				return -1;
-			}
+			chain_pos += e->cnt;
+		}
+		/* TARGET lies in a hole behind extent I - 1. */
+		if(!do_alloc){
+			return -2;
 		}
-		return cluster_to_sector(clst);
+		return fill_hole(inode, i, target, chain_pos);
 	}
 	return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes keyed by sector, so that opening a single inode twice
+ * returns the same `struct inode'.  OPEN_INODES_LOCK guards the table
+ * and every inode's open_cnt, but is never held across disk I/O. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+static uint64_t
+inode_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct inode_key, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct inode_key, elem)->sector
+		< hash_entry (b, struct inode_key, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("open inode table allocation failed");
+	lock_init (&open_inodes_lock);
+
+	lock_init (&ra_lock);
+	uint8_t *data = malloc (RA_SLOTS * DISK_SECTOR_SIZE);
+	if (data == NULL)
+		PANIC ("readahead cache allocation failed");
+	for (size_t i = 0; i < RA_SLOTS; i++) {
+		ra_slots[i].state = RA_EMPTY;
+		ra_slots[i].data = data + i * DISK_SECTOR_SIZE;
+	}
+}
+
+/* Returns the readahead slot holding SECTOR, or a null pointer.
+ * Called with ra_lock held. */
+static struct ra_slot *
+ra_find (disk_sector_t sector) {
+	for (size_t i = 0; i < RA_SLOTS; i++)
+		if (ra_slots[i].state != RA_EMPTY && ra_slots[i].sector == sector)
+			return &ra_slots[i];
+	return NULL;
+}
+
+/* Waits for SLOT's read, if any, to finish.  Drops ra_lock while
+ * waiting.  The ready semaphore is up'd again for any other waiter. */
+static void
+ra_wait (struct ra_slot *slot) {
+	if (slot->state == RA_PENDING) {
+		lock_release (&ra_lock);
+		sema_down (&slot->ready);
+		sema_up (&slot->ready);
+		lock_acquire (&ra_lock);
+	}
+}
+
+/* Completion callback of a readahead read, possibly in an interrupt
+ * handler. */
+static void
+ra_done (struct disk_request *r) {
+	struct ra_slot *slot = r->aux;
+	slot->state = RA_READY;
+	sema_up (&slot->ready);
+}
+
+/* Copies SECTOR into BUFFER if readahead brought it in, waiting for a
+ * read still in flight.  Returns true on a hit.  A consumed sector is
+ * the first to be reused. */
+static bool
+ra_take (disk_sector_t sector, void *buffer) {
+	bool hit = false;
+
+	lock_acquire (&ra_lock);
+	struct ra_slot *slot = ra_find (sector);
+	if (slot != NULL) {
+		ra_wait (slot);
+		if (slot->state == RA_READY && slot->sector == sector) {
+			memcpy (buffer, slot->data, DISK_SECTOR_SIZE);
+			slot->accessed = false;
+			hit = true;
+		}
+	}
+	lock_release (&ra_lock);
+	return hit;
+}
+
+/* Drops any prefetched copy of sectors LO through HI, which are being
+ * overwritten. */
+static void
+ra_invalidate (disk_sector_t lo, disk_sector_t hi) {
+	lock_acquire (&ra_lock);
+	for (size_t i = 0; i < RA_SLOTS; i++) {
+		struct ra_slot *slot = &ra_slots[i];
+		if (slot->state == RA_EMPTY || slot->sector < lo || slot->sector > hi)
+			continue;
+		ra_wait (slot);
+		if (slot->state == RA_READY && slot->sector >= lo && slot->sector <= hi)
+			slot->state = RA_EMPTY;
+	}
+	lock_release (&ra_lock);
+}
+
+/* Starts an asynchronous read of SECTOR into the readahead cache,
+ * unless it is there already or every slot is busy. */
+static void
+ra_prefetch (disk_sector_t sector) {
+	lock_acquire (&ra_lock);
+	if (ra_find (sector) == NULL) {
+		for (size_t i = 0; i < 2 * RA_SLOTS; i++) {
+			struct ra_slot *slot = &ra_slots[ra_hand];
+			ra_hand = (ra_hand + 1) % RA_SLOTS;
+			if (slot->state == RA_PENDING)
+				continue;
+			if (slot->state == RA_READY && slot->accessed) {
+				slot->accessed = false;
+				continue;
+			}
+
+			slot->sector = sector;
+			slot->state = RA_PENDING;
+			slot->accessed = true;
+			sema_init (&slot->ready, 0);
+			disk_request_init (&slot->req, filesys_disk, sector, 1,
+			                   slot->data, false);
+			slot->req.done = ra_done;
+			slot->req.aux = slot;
+			disk_submit (&slot->req);
+			break;
+		}
+	}
+	lock_release (&ra_lock);
+}
+
+/* Feeds a read of SIZE bytes at OFFSET of INODE into RA, the
+ * readahead state of one open file.  A read that starts where the
+ * last one ended grows the window, up to RA_MAX sectors; any other
+ * read collapses it.  While the window is open, the sectors up to a
+ * window past this read are prefetched, each at most once. */
+void
+inode_readahead (struct inode *inode, struct readahead *ra,
+                 off_t offset, off_t size) {
+	if (offset == ra->next && size > 0) {
+		ra->window = ra->window == 0 ? RA_MIN
+		           : ra->window * 2 > RA_MAX ? RA_MAX : ra->window * 2;
+	} else {
+		ra->window = 0;
+		ra->ahead = 0;
+	}
+	ra->next = offset + size;
+	if (ra->window == 0)
+		return;
+
+	rwlock_acquire_read (&inode->rw);
+	if (is_inline (inode)) {
+		rwlock_release_read (&inode->rw);
+		return;
+	}
+	size_t first = bytes_to_sectors (offset + size);
+	size_t last = first + ra->window;
+	size_t end = bytes_to_sectors (inode_length (inode));
+	if (first < ra->ahead)
+		first = ra->ahead;
+	if (last > end)
+		last = end;
+	for (size_t i = first; i < last; i++) {
+		disk_sector_t sector =
+			byte_to_sector (inode, (off_t) i * DISK_SECTOR_SIZE, false);
+		if (sector != (disk_sector_t) -1 && sector != (disk_sector_t) -2)
+			ra_prefetch (sector);
+	}
+	if (last > ra->ahead)
+		ra->ahead = last;
+	rwlock_release_read (&inode->rw);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -101,31 +468,40 @@ inode_create (disk_sector_t sector, off_t length, enum inode_status f_d_s) {
 
 	disk_inode = calloc (1, sizeof *disk_inode);
 	if (disk_inode != NULL) {
-		cluster_t clst = fat_create_chain(0, 0);
-		size_t sectors = bytes_to_sectors (length);
 		disk_inode->length = length;
 		disk_inode->f_d_s = f_d_s;
 		disk_inode->magic = INODE_MAGIC;
+		if ((size_t) length <= INLINE_BYTES) {
+			/* Small enough to live in the inode sector; calloc()
+			 * zeroed the data. */
+			disk_write (filesys_disk, sector, disk_inode);
+			free (disk_inode);
+			return true;
+		}
+
+		cluster_t clst = fat_create_chain(0);
+		size_t sectors = bytes_to_sectors (length);
 		if (clst) {
 			disk_inode->clst = clst;
 			disk_inode->last_clst = clst;
 			disk_inode->start = cluster_to_sector(clst);
+			disk_inode->ext_cnt = 1;
+			/* The data is reserved, not zeroed: an unwritten extent
+			 * reads as zeros until it is written. */
+			disk_inode->extents[0] = (struct inode_extent) {0, sectors, 1};
 			
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-				for (i = 0; i < sectors-1; i++) {
-					disk_write (filesys_disk, cluster_to_sector(clst), zeros);
-					clst = fat_create_chain(clst, i+1);
-					if (clst == 0) return false;
-				}
-				disk_inode->last_clst = clst;
-				disk_inode->f_d_s = f_d_s;
-				disk_write (filesys_disk, cluster_to_sector(clst), zeros);
+			if (sectors > 1) {
+				/* Reserve the rest of the file as one run behind the
+				 * first cluster. */
+				disk_inode->last_clst = fat_create_run(clst, sectors-1, 0, 0);
+			}
+			if (disk_inode->last_clst != 0) {
+				disk_write (filesys_disk, sector, disk_inode);
+				success = true; 
+			} else {
+				fat_remove_chain (clst, 0);
 			}
-			success = true; 
 		} 
-		disk_write (filesys_disk, sector, disk_inode);
 		free (disk_inode);
 	}
 	return success;
@@ -136,46 +512,104 @@ inode_create (disk_sector_t sector, off_t length, enum inode_status f_d_s) {
  * Returns a null pointer if memory allocation fails. */
 struct inode *
 inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+	struct hash_elem *e;
 	struct inode *inode;
+	struct inode_key key;
 
-	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
+	/* Check whether this inode is already open, and if it is still
+	 * being read in, wait for that. */
+	lock_acquire (&open_inodes_lock);
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	if (e != NULL) {
+		inode = hash_entry (e, struct inode, key.elem);
+		inode->open_cnt++;
+		if (inode->closing)
+			inode->reopened = true;
+		while (inode->state == INODE_LOADING)
+			cond_wait (&inode->loaded, &open_inodes_lock);
+		lock_release (&open_inodes_lock);
+		if (inode->state == INODE_FAILED) {
+			inode_close (inode);
+			return NULL;
 		}
+		return inode; 
 	}
 
 	/* Allocate memory. */
 	inode = malloc (sizeof *inode);
-	if (inode == NULL)
+	if (inode == NULL) {
+		lock_release (&open_inodes_lock);
 		return NULL;
+	}
 
-	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
-	inode->sector = sector;
+	/* Initialize, and publish the inode before reading it in, so
+	 * that other openers of SECTOR wait for this one. */
+	inode->key.sector = sector;
+	hash_insert (&open_inodes, &inode->key.elem);
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->state = INODE_LOADING;
+	cond_init (&inode->loaded);
+	inode->closing = false;
+	inode->reopened = false;
+	inode->overflow = NULL;
+	inode->overflow_cap = 0;
+	inode->delay_buf = NULL;
+	inode->delay_reserved = 0;
+	inode->dir_index = NULL;
+	rwlock_init (&inode->rw);
+	lock_init (&inode->dir_lock);
+	lock_release (&open_inodes_lock);
+
+	disk_read (filesys_disk, inode->key.sector, &inode->data);
+
+	/* Bring in the extents that did not fit in the inode. */
+	bool success = true;
+	if (inode->data.ext_cnt > INLINE_EXTENTS) {
+		size_t blocks = DIV_ROUND_UP (inode->data.ext_cnt - INLINE_EXTENTS,
+		                              EXTENTS_PER_BLOCK);
+		inode->overflow_cap = blocks * EXTENTS_PER_BLOCK;
+		inode->overflow = malloc (inode->overflow_cap * sizeof *inode->overflow);
+		if (inode->overflow == NULL)
+			success = false;
+		else {
+			cluster_t clst = inode->data.ext_overflow;
+			for (size_t b = 0; b < blocks; b++) {
+				disk_read (filesys_disk, cluster_to_sector (clst),
+				           inode->overflow + b * EXTENTS_PER_BLOCK);
+				clst = fat_get (clst);
+			}
+		}
+	}
+
+	lock_acquire (&open_inodes_lock);
+	inode->state = success ? INODE_READY : INODE_FAILED;
+	cond_broadcast (&inode->loaded, &open_inodes_lock);
+	lock_release (&open_inodes_lock);
+	if (!success) {
+		inode_close (inode);
+		return NULL;
+	}
 	return inode;
 }
 
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		lock_acquire (&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release (&open_inodes_lock);
+	}
 	return inode;
 }
 
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
-	return inode->sector;
+	return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
@@ -187,19 +621,56 @@ inode_close (struct inode *inode) {
 	if (inode == NULL)
 		return;
 	
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
-		struct disk *filesys_disk = disk_get (0, 1);
-		disk_write(filesys_disk, inode->sector, &inode->data);
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			fat_remove_chain(sector_to_cluster(inode->sector), 0);
-			fat_remove_chain(inode->data.clst, 0);
+	lock_acquire (&open_inodes_lock);
+	if (--inode->open_cnt > 0 || inode->closing) {
+		/* Not the last opener, or the last one is already writing
+		 * the inode back and will notice this reopen. */
+		lock_release (&open_inodes_lock);
+		return;
+	}
+
+	/* Write back with the table unlocked.  The inode stays in the
+	 * table until then, so a new opener of its sector takes it back
+	 * instead of reading the sector before it is written.  If that
+	 * happens and the inode is closed again meanwhile, write it back
+	 * once more. */
+	inode->closing = true;
+	while (!inode->removed && inode->state == INODE_READY) {
+		inode->reopened = false;
+		lock_release (&open_inodes_lock);
+
+		rwlock_acquire_write (&inode->rw);
+		inode_flush_delayed (inode);
+		inode_store (inode);
+		rwlock_release_write (&inode->rw);
+
+		lock_acquire (&open_inodes_lock);
+		if (inode->open_cnt > 0) {
+			inode->closing = false;
+			lock_release (&open_inodes_lock);
+			return;
 		}
-		free (inode); 
+		if (!inode->reopened)
+			break;
 	}
+	hash_delete (&open_inodes, &inode->key.elem);
+	lock_release (&open_inodes_lock);
+
+	/* Deallocate blocks if removed. */
+	if (inode->removed) {
+		fat_remove_chain(sector_to_cluster(inode->key.sector), 0);
+		fat_remove_chain(inode->data.clst, 0);
+		fat_remove_chain(inode->data.ext_overflow, 0);
+		if (inode->data.f_d_s == DIR_INODE)
+			dcache_purge (inode->key.sector);
+		if (inode->delay_buf != NULL) {
+			palloc_free_page (inode->delay_buf);
+			fat_unreserve (inode->delay_reserved);
+		}
+	}
+	dir_index_destroy (inode->dir_index);
+	free (inode->overflow);
+	free (inode); 
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -210,14 +681,25 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
- * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
-off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+/* Does the work of inode_read_at() with INODE's lock held shared. */
+static off_t
+read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
+	struct disk_batch batch;
+
+	if (is_inline (inode)) {
+		if (offset >= inode->data.length || size <= 0)
+			return 0;
+		if (size > inode->data.length - offset)
+			size = inode->data.length - offset;
+		memcpy (buffer, inode->data.inline_data + offset, size);
+		return size;
+	}
+
+	/* Whole sectors are queued together and waited for once. */
+	disk_batch_init (&batch);
 	while (size > 0) {
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
@@ -230,10 +712,21 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		int chunk_size = size < min_left ? size : min_left;
 		if (chunk_size <= 0)
 			break;
+
+		if (inode->delay_buf != NULL && offset >= inode->delay_start) {
+			/* Not yet allocated: the data is in memory. */
+			memcpy (buffer + bytes_read,
+			        inode->delay_buf + (offset - inode->delay_start), chunk_size);
+			size -= chunk_size;
+			offset += chunk_size;
+			bytes_read += chunk_size;
+			continue;
+		}
 		
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset, false);
 		if(sector_idx == (disk_sector_t)-1){
+			disk_batch_wait (&batch);
 			free(bounce);
 			return 0;
 		}
@@ -242,21 +735,23 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			/* Read full sector directly into caller's buffer. */
 			if(sector_idx == (disk_sector_t)-2){
 				memset(buffer + bytes_read, 0, DISK_SECTOR_SIZE);
-			} else{
-				disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+			} else if(!ra_take (sector_idx, buffer + bytes_read)){
+				disk_batch_add (&batch, filesys_disk, sector_idx, 1,
+						buffer + bytes_read, false);
 			}
 		} else {
 			/* Read sector into bounce buffer, then partially copy
 			 * into caller's buffer. */
 			if(sector_idx == (disk_sector_t)-2){
-				memcpy (buffer + bytes_read, 0, chunk_size);
+				memset (buffer + bytes_read, 0, chunk_size);
 			} else{
 				if (bounce == NULL) {
 					bounce = malloc (DISK_SECTOR_SIZE);
 					if (bounce == NULL)
 						break;
 				}
-				disk_read (filesys_disk, sector_idx, bounce);
+				if (!ra_take (sector_idx, bounce))
+					disk_read (filesys_disk, sector_idx, bounce);
 				memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
 			}
 		}
@@ -266,40 +761,88 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
+	disk_batch_wait (&batch);
 	free (bounce);
 
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	rwlock_acquire_read (&inode->rw);
+	off_t bytes_read = read_at (inode, buffer, size, offset);
+	rwlock_release_read (&inode->rw);
+	return bytes_read;
+}
+
+/* Does the work of inode_write_at() with INODE's lock held
+ * exclusive. */
+static off_t
+write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
 	uint8_t *bounce = NULL;
+	struct disk_batch batch;
+	disk_sector_t batch_lo = (disk_sector_t) -1, batch_hi = 0;
 	
 	if (inode->deny_write_cnt){
 		return 0;
 	}
 
+	if (is_inline (inode) && size > 0) {
+		if (offset + size > (off_t) INLINE_BYTES) {
+			if (!inline_migrate (inode))
+				return 0;
+		} else {
+			/* Stays inline: the data goes out with the inode. */
+			memcpy (inode->data.inline_data + offset, buffer, size);
+			if (offset + size > inode->data.length)
+				inode->data.length = offset + size;
+			inode_store (inode);
+			return size;
+		}
+	}
+
 	// off_t new_size = offset + strlen(buffer) + 1 < offset + size ? offset + strlen(buffer) + 1 : offset + size;
 	off_t new_size = offset + size;
-	if(new_size > inode_length(inode)){
-		inode_grow(inode, offset, new_size);
+	off_t delay_start = alloc_end(inode);
+	off_t delayed = 0;
+	if(size > 0 && new_size > delay_start
+			&& new_size <= delay_start + DELAY_BYTES
+			&& delay_admit(inode, delay_start, new_size)){
+		/* The part past the allocated sectors fits in the delay page:
+		 * keep it there, to be allocated later in one run. */
+		off_t from = offset > delay_start ? offset : delay_start;
+		inode->delay_start = delay_start;
+		delayed = new_size - from;
+		memcpy(inode->delay_buf + (from - delay_start),
+		       buffer + (from - offset), delayed);
+		size -= delayed;
+		if(new_size > inode_length(inode)){
+			inode->data.length = new_size;
+		}
+	} else if(new_size > delay_start){
+		inode_flush_delayed(inode);
+		if(new_size > alloc_end(inode)){
+			inode_grow(inode, offset, new_size);
+		} else if(new_size > inode_length(inode)){
+			inode->data.length = new_size;
+		}
+	} else if(new_size > inode_length(inode)){
+		/* Still within the allocated sectors: the new length goes to
+		 * disk with the inode. */
+		inode->data.length = new_size;
 	}
+	if (size > 0)
+		ext_mark_written (inode, offset, offset + size);
 
+	/* Whole sectors are queued together and waited for once. */
+	disk_batch_init (&batch);
 	while (size > 0) {
-		disk_sector_t sector_idx = byte_to_sector (inode, offset, true);
-		if(sector_idx == (disk_sector_t)-1){
-			free(bounce);
-			return 0;
-		} 
-		
 		/* Sector to write, starting byte offset within sector. */
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
@@ -312,9 +855,29 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
+		/* A sector written only in part keeps its other bytes, unless
+		 * it is a hole and has none yet. */
+		bool partial = sector_ofs > 0 || chunk_size < sector_left;
+		bool hole = partial
+		            && byte_to_sector (inode, offset, false) == (disk_sector_t) -2;
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, true);
+		if(sector_idx == (disk_sector_t)-1){
+			disk_batch_wait (&batch);
+			free(bounce);
+			return 0;
+		} 
+
+		/* A prefetched copy is stale now.  Dropping it again once the
+		 * write is done catches a prefetch racing with the write. */
+		ra_invalidate (sector_idx, sector_idx);
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
 			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+			if (sector_idx < batch_lo)
+				batch_lo = sector_idx;
+			if (sector_idx > batch_hi)
+				batch_hi = sector_idx;
+			disk_batch_add (&batch, filesys_disk, sector_idx, 1,
+					(void *) (buffer + bytes_written), true);
 		} else {
 			/* We need a bounce buffer. */
 			if (bounce == NULL) {
@@ -325,12 +888,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 			/* If the sector contains data before or after the chunk
 			   we're writing, then we need to read in the sector
 			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
+			if (partial && !hole) 
 				disk_read (filesys_disk, sector_idx, bounce);
 			else
 				memset (bounce, 0, DISK_SECTOR_SIZE);
 			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
 			disk_write (filesys_disk, sector_idx, bounce); 
+			ra_invalidate (sector_idx, sector_idx);
 		}
 
 		/* Advance. */
@@ -338,8 +902,25 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
+	disk_batch_wait (&batch);
+	if (batch_lo <= batch_hi)
+		ra_invalidate (batch_lo, batch_hi);
 	free (bounce);
 
+	return size == 0 ? bytes_written + delayed : bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if end of file is reached or an error occurs.
+ * (Normally a write at end of file would extend the inode, but
+ * growth is not yet implemented.) */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	rwlock_acquire_write (&inode->rw);
+	off_t bytes_written = write_at (inode, buffer, size, offset);
+	rwlock_release_write (&inode->rw);
 	return bytes_written;
 }
 
@@ -348,8 +929,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	void
 inode_deny_write (struct inode *inode) 
 {
+	rwlock_acquire_write (&inode->rw);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -357,12 +940,16 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	rwlock_acquire_write (&inode->rw);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	rwlock_release_write (&inode->rw);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  Takes no lock: the
+ * read is a single word, and callers inside this file already hold
+ * INODE's lock. */
 off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
@@ -379,41 +966,510 @@ is_inode_removed(struct inode *inode){
 	return inode->removed;
 }
 
+/* Allocates INODE's sectors from OFS up to NEW_SIZE and stores the
+ * inode.  The new clusters may hold a deleted file's data, so they
+ * are allocated unwritten: the caller's write turns the sectors it
+ * fills into ordinary ones with ext_mark_written(), which zeroes
+ * those it only partly covers.  Called with INODE's lock held
+ * exclusive. */
 void
 inode_grow(struct inode *inode, off_t ofs, off_t new_size){
-	size_t old_sector_idx = ofs > inode_length(inode) ? ofs / DISK_SECTOR_SIZE : inode_length(inode) / DISK_SECTOR_SIZE;
-	size_t new_sector_idx = bytes_to_sectors(new_size);
-	size_t alloc_sectors = new_sector_idx - old_sector_idx;
-	if(old_sector_idx > fat_info_get(inode->data.last_clst)){
-		alloc_sectors++;
+	if(!alloc_tail(inode, ofs / DISK_SECTOR_SIZE, bytes_to_sectors(new_size),
+	               true, 0)){
+		return;
+	}
+	/* A hole punched at the end leaves the length past the last
+	 * extent, so a write into it must not shorten the file. */
+	if(new_size > inode->data.length)
+		inode->data.length = new_size;
+
+	inode_store(inode);
+}
+
+/* Allocates sectors FIRST_IDX up to END_IDX of INODE that lie past its
+ * last extent, as one run, marked UNWRITTEN or not.  Sectors from the
+ * end of the last extent up to FIRST_IDX stay a hole.  Up to RESERVED
+ * of the clusters come from a fat_reserve() reservation.  Returns
+ * false if out of memory or disk space. */
+static bool
+alloc_tail (struct inode *inode, size_t first_idx, size_t end_idx,
+            bool unwritten, size_t reserved) {
+	struct inode_extent *last = ext_at(inode, inode->data.ext_cnt - 1);
+	size_t alloc_end = last->start + last->cnt;
+	if(first_idx < alloc_end){
+		first_idx = alloc_end;
+	}
+	if(end_idx <= first_idx){
+		return true;
 	}
 
+	bool extend = first_idx == alloc_end && last->unwritten == unwritten;
+	if(!extend && !ext_reserve(inode, 1)){
+		return false;
+	}
+	/* The file's own tail is the allocation goal, so the new
+	 * clusters extend its run whenever the space behind it is
+	 * free. */
 	cluster_t clst = inode->data.last_clst;
-	for(int i=0; i<alloc_sectors; i++){
-		clst = fat_create_chain(clst, old_sector_idx + i);
+	clst = fat_create_run(clst, end_idx - first_idx, clst + 1, reserved);
+	if(clst == 0){
+		return false;
+	}
+	inode->data.last_clst = clst;
+	if(extend){
+		ext_at(inode, inode->data.ext_cnt - 1)->cnt += end_idx - first_idx;
+	} else{
+		ext_insert(inode, inode->data.ext_cnt,
+		           (struct inode_extent) {first_idx, end_idx - first_idx,
+		                                  unwritten});
+	}
+	return true;
+}
+
+/* Allocates hole sector TARGET of INODE, which lies before extent
+ * EXT_IDX; POS is that extent's position in the chain.  The new cluster
+ * goes into the chain behind the previous extent's last cluster, aimed
+ * at where a contiguous layout would put it, which keeps sparse files
+ * sequential once filled in. */
+static disk_sector_t
+fill_hole (struct inode *inode, size_t ext_idx, uint32_t target, size_t pos) {
+	cluster_t clst;
+
+	if(!ext_reserve(inode, 1)){
+		return -1;
+	}
+
+	if(ext_idx == 0){
+		/* In front of the first extent, left by a punched hole: the
+		 * new cluster heads the chain. */
+		cluster_t head = inode->data.clst;
+		uint32_t gap = ext_at(inode, 0)->start - target;
+		clst = fat_create_run(0, 1, head > gap ? head - gap : 0, 0);
 		if(clst == 0){
-			return;
+			return -1;
+		}
+		fat_put(clst, head);
+		inode->data.clst = clst;
+		inode->data.start = cluster_to_sector(clst);
+	} else{
+		struct inode_extent *prev = ext_at(inode, ext_idx - 1);
+		cluster_t pclst = chain_nth(inode->data.clst, pos - 1);
+		if(pclst == 0){
+			return -1;
+		}
+		cluster_t goal = pclst + (target - (prev->start + prev->cnt - 1));
+		clst = fat_insert_chain(pclst, goal);
+		if(clst == 0){
+			return -1;
+		}
+		if(pclst == inode->data.last_clst){
+			inode->data.last_clst = clst;
+		}
+	}
+
+	ext_insert(inode, ext_idx, (struct inode_extent) {target, 1, 0});
+	ext_merge(inode, ext_idx);
+	inode_store(inode);
+	return cluster_to_sector(clst);
+}
+
+/* Writes zeros over sector N of INODE's chain. */
+static void
+zero_chain_sector (struct inode *inode, size_t n) {
+	static char zeros[DISK_SECTOR_SIZE];
+	cluster_t clst = chain_nth (inode->data.clst, n);
+	if (clst == 0)
+		return;
+	disk_sector_t sector = cluster_to_sector (clst);
+	disk_write (filesys_disk, sector, zeros);
+	ra_invalidate (sector, sector);
+}
+
+/* Splits extent I of INODE, which holds sectors LO to HI, so that LO
+ * to HI become an ordinary extent of their own, merged with any
+ * ordinary neighbours.  Returns false if out of memory. */
+static bool
+ext_split_written (struct inode *inode, size_t i, uint32_t lo, uint32_t hi) {
+	struct inode_extent e = *ext_at (inode, i);
+	uint32_t end = e.start + e.cnt;
+
+	if (!ext_reserve (inode, 2))
+		return false;
+	if (hi + 1 < end)
+		ext_insert (inode, i + 1,
+		            (struct inode_extent) {hi + 1, end - hi - 1, e.unwritten});
+	if (lo > e.start) {
+		ext_at (inode, i)->cnt = lo - e.start;
+		ext_insert (inode, ++i, (struct inode_extent) {lo, hi - lo + 1, 0});
+	} else {
+		ext_at (inode, i)->cnt = hi - lo + 1;
+		ext_at (inode, i)->unwritten = 0;
+	}
+	ext_merge (inode, i);
+	return true;
+}
+
+/* Turns the unwritten sectors that a write to bytes FROM up to TO of
+ * INODE is about to fill into ordinary ones.  An unwritten sector the
+ * write covers only in part is zeroed first, since the write reads
+ * back the rest of it. */
+static void
+ext_mark_written (struct inode *inode, off_t from, off_t to) {
+	uint32_t first = from / DISK_SECTOR_SIZE;
+	uint32_t last = (to - 1) / DISK_SECTOR_SIZE;
+	bool changed = false;
+
+	for (;;) {
+		/* Find the next unwritten extent in the range. */
+		struct inode_extent *e = NULL;
+		size_t i, pos = 0;
+		for (i = 0; i < inode->data.ext_cnt; i++) {
+			e = ext_at (inode, i);
+			if (e->start > last || (e->unwritten && e->start + e->cnt > first))
+				break;
+			pos += e->cnt;
+		}
+		if (i == inode->data.ext_cnt || e->start > last)
+			break;
+
+		uint32_t lo = first > e->start ? first : e->start;
+		uint32_t hi = last < e->start + e->cnt - 1 ? last : e->start + e->cnt - 1;
+		if ((lo == first && from % DISK_SECTOR_SIZE != 0)
+				|| (lo == last && to % DISK_SECTOR_SIZE != 0))
+			zero_chain_sector (inode, pos + lo - e->start);
+		if (hi != lo && hi == last && to % DISK_SECTOR_SIZE != 0)
+			zero_chain_sector (inode, pos + hi - e->start);
+
+		if (!ext_split_written (inode, i, lo, hi)) {
+			/* No memory to split it: zero the whole extent instead. */
+			e = ext_at (inode, i);
+			for (uint32_t k = 0; k < e->cnt; k++)
+				zero_chain_sector (inode, pos + k);
+			e->unwritten = 0;
+			ext_merge (inode, i);
 		}
+		changed = true;
 	}
-	inode->data.length = new_size;
+	if (changed)
+		inode_store (inode);
+}
+
+/* Reserves the sectors of bytes OFFSET up to OFFSET + LEN of INODE
+ * without writing them, and extends the file over them.  The sectors
+ * past its last allocated one are taken as a single run and marked
+ * unwritten, so they read as zeros until written; holes before that
+ * are left as they are.  Returns false if INODE denies writes or the
+ * disk is full. */
+bool
+inode_fallocate (struct inode *inode, off_t offset, off_t len) {
+	off_t end = offset + len;
+	bool success = false;
+
+	rwlock_acquire_write (&inode->rw);
+	if (inode->deny_write_cnt)
+		goto done;
+	if (is_inline (inode) && end > (off_t) INLINE_BYTES
+			&& !inline_migrate (inode))
+		goto done;
+	if (!is_inline (inode)) {
+		inode_flush_delayed (inode);
+		if (!alloc_tail (inode, offset / DISK_SECTOR_SIZE,
+		                 bytes_to_sectors (end), true, 0))
+			goto done;
+	}
+	if (end > inode->data.length)
+		inode->data.length = end;
+	inode_store (inode);
+	success = true;
+
+done:
+	rwlock_release_write (&inode->rw);
+	return success;
+}
+
+/* Zeros bytes FROM up to TO of INODE, which lie in one sector. */
+static void
+zero_bytes (struct inode *inode, off_t from, off_t to) {
+	uint8_t data[DISK_SECTOR_SIZE];
+
+	if (from >= to)
+		return;
+	disk_sector_t sector = byte_to_sector (inode, from, false);
+	if (sector == (disk_sector_t) -1 || sector == (disk_sector_t) -2)
+		return;
+	disk_read (filesys_disk, sector, data);
+	memset (data + from % DISK_SECTOR_SIZE, 0, to - from);
+	disk_write (filesys_disk, sector, data);
+	ra_invalidate (sector, sector);
+}
+
+/* Frees INODE's clusters for sectors FIRST up to STOP.  The first
+ * cluster of the chain is kept, unwritten, if all would go, so the
+ * chain keeps its head.  Returns false if out of memory, with some
+ * of the sectors left in place. */
+static bool
+ext_punch (struct inode *inode, uint32_t first, uint32_t stop) {
+	size_t total = 0, punched = 0;
+	bool success = true;
+
+	for (size_t i = 0; i < inode->data.ext_cnt; i++) {
+		struct inode_extent *e = ext_at (inode, i);
+		uint32_t lo = first > e->start ? first : e->start;
+		uint32_t hi = stop < e->start + e->cnt ? stop : e->start + e->cnt;
+		total += e->cnt;
+		if (lo < hi)
+			punched += hi - lo;
+	}
+	if (punched == 0)
+		return true;
+	bool keep = punched == total;
+	if (keep)
+		first = ext_at (inode, 0)->start + 1;
+
+	/* Last extent first, so that the chain positions of the ones
+	 * still to do stay put. */
+	size_t pos = total;
+	for (size_t i = inode->data.ext_cnt; i-- > 0; ) {
+		struct inode_extent *e = ext_at (inode, i);
+		uint32_t end = e->start + e->cnt;
+		uint32_t lo = first > e->start ? first : e->start;
+		uint32_t hi = stop < end ? stop : end;
+		pos -= e->cnt;
+		if (lo >= hi)
+			continue;
+		if (lo > e->start && hi < end) {
+			if (!ext_reserve (inode, 1)) {
+				success = false;
+				continue;
+			}
+			e = ext_at (inode, i);
+		}
+
+		/* Unlink the clusters from the chain. */
+		size_t n = pos + (lo - e->start);
+		cluster_t pclst = n > 0 ? chain_nth (inode->data.clst, n - 1) : 0;
+		cluster_t clst = pclst != 0 ? fat_get (pclst) : inode->data.clst;
+		cluster_t next = fat_remove_run (pclst, clst, hi - lo);
+		if (pclst == 0) {
+			inode->data.clst = next;
+			inode->data.start = cluster_to_sector (next);
+		}
+
+		/* Trim the extent. */
+		if (lo == e->start && hi == end) {
+			ext_remove (inode, i);
+		} else if (lo == e->start) {
+			e->start = hi;
+			e->cnt = end - hi;
+		} else if (hi == end) {
+			e->cnt = lo - e->start;
+		} else {
+			bool unwritten = e->unwritten;
+			e->cnt = lo - e->start;
+			ext_insert (inode, i + 1,
+			            (struct inode_extent) {hi, end - hi, unwritten});
+		}
+		total -= hi - lo;
+	}
+
+	if (keep)
+		ext_at (inode, 0)->unwritten = 1;
+	inode->data.last_clst = chain_nth (inode->data.clst, total - 1);
+	return success;
+}
+
+/* Frees the clusters of INODE's sectors that lie wholly within bytes
+ * OFFSET up to OFFSET + LEN, leaving holes that read as zeros, and
+ * zeros the range's bytes in the sectors it covers in part.  The
+ * file keeps its length.  Returns false if INODE denies writes or
+ * memory runs out. */
+bool
+inode_punch_hole (struct inode *inode, off_t offset, off_t len) {
+	bool success = false;
+
+	rwlock_acquire_write (&inode->rw);
+	if (inode->deny_write_cnt)
+		goto done;
+	off_t end = offset + len < inode->data.length
+	            ? offset + len : inode->data.length;
+	success = true;
+	if (offset >= end)
+		goto done;
+
+	if (is_inline (inode)) {
+		memset (inode->data.inline_data + offset, 0, end - offset);
+		inode_store (inode);
+		goto done;
+	}
+	inode_flush_delayed (inode);
+
+	/* Sectors covered in part are zeroed; the rest are freed.  A hole
+	 * reaching the end of the file takes its last sector too. */
+	uint32_t first = DIV_ROUND_UP (offset, DISK_SECTOR_SIZE);
+	uint32_t stop = end / DISK_SECTOR_SIZE;
+	off_t head_end = (off_t) first * DISK_SECTOR_SIZE;
+	zero_bytes (inode, offset, head_end < end ? head_end : end);
+	if (end == inode->data.length)
+		stop = bytes_to_sectors (end);
+	else if ((off_t) stop * DISK_SECTOR_SIZE > offset)
+		zero_bytes (inode, (off_t) stop * DISK_SECTOR_SIZE, end);
+	if (first < stop)
+		success = ext_punch (inode, first, stop);
+	inode_store (inode);
+
+done:
+	rwlock_release_write (&inode->rw);
+	return success;
+}
+
+/* Moves inline INODE's data out to a cluster of its own, so that it
+ * can grow past INLINE_BYTES.  Returns false if the disk is full. */
+static bool
+inline_migrate (struct inode *inode) {
+	uint8_t data[DISK_SECTOR_SIZE];
+
+	ASSERT (is_inline (inode));
+	cluster_t clst = fat_create_chain (0);
+	if (clst == 0)
+		return false;
+
+	memset (data, 0, sizeof data);
+	memcpy (data, inode->data.inline_data, INLINE_BYTES);
+	disk_write (filesys_disk, cluster_to_sector (clst), data);
+	ra_invalidate (cluster_to_sector (clst), cluster_to_sector (clst));
+
+	memset (inode->data.extents, 0, sizeof inode->data.extents);
+	inode->data.clst = clst;
 	inode->data.last_clst = clst;
+	inode->data.start = cluster_to_sector (clst);
+	inode->data.ext_cnt = 1;
+	inode->data.extents[0] = (struct inode_extent) {0, 1, 0};
+	inode_store (inode);
+	return true;
+}
 
-	disk_write(filesys_disk, inode->sector, &inode->data);
+/* Gets INODE's delay page ready to hold the file from DELAY_START up
+ * to NEW_SIZE, reserving the clusters all of it will need.  Returns
+ * false if a page or the clusters are not to be had, in which case
+ * the write should allocate right away and come up short if the disk
+ * is full. */
+static bool
+delay_admit (struct inode *inode, off_t delay_start, off_t new_size) {
+	off_t end = new_size > inode->data.length ? new_size : inode->data.length;
+	size_t need = bytes_to_sectors (end) - delay_start / DISK_SECTOR_SIZE;
+
+	/* A hole punched at the end can leave the length past the page. */
+	if (end > delay_start + DELAY_BYTES)
+		return false;
+	if (inode->delay_buf == NULL) {
+		inode->delay_buf = palloc_get_page (PAL_ZERO);
+		if (inode->delay_buf == NULL)
+			return false;
+	}
+	if (need > inode->delay_reserved) {
+		if (!fat_reserve (need - inode->delay_reserved)) {
+			if (inode->delay_reserved == 0) {
+				palloc_free_page (inode->delay_buf);
+				inode->delay_buf = NULL;
+			}
+			return false;
+		}
+		inode->delay_reserved = need;
+	}
+	return true;
 }
 
-disk_sector_t
-inode_fill_lazy_clst(uint32_t pclst, off_t file_idx){
-	return cluster_to_sector(fat_insert_chain(pclst, file_idx));
+/* Allocates INODE's delayed data as one run of clusters, writes it
+ * out, and writes the inode once. */
+static void
+inode_flush_delayed (struct inode *inode) {
+	if (inode->delay_buf == NULL)
+		return;
+
+	off_t start = inode->delay_start;
+	off_t length = inode->data.length;
+	ASSERT (start == alloc_end (inode));
+	if (length > start) {
+		/* The clusters were reserved as the data came in, so this
+		 * only fails if out of memory. */
+		size_t cnt = bytes_to_sectors (length - start);
+		inode->data.length = start;
+		if (alloc_tail (inode, start / DISK_SECTOR_SIZE,
+		                start / DISK_SECTOR_SIZE + cnt, false,
+		                inode->delay_reserved)) {
+			inode->delay_reserved -= cnt < inode->delay_reserved
+				? cnt : inode->delay_reserved;
+			inode->data.length = length;
+			inode_store (inode);
+
+			struct disk_batch batch;
+			disk_batch_init (&batch);
+			for (size_t i = 0; i < cnt; i++) {
+				disk_sector_t sector = byte_to_sector (inode,
+				                                       start + i * DISK_SECTOR_SIZE, false);
+				if (sector == (disk_sector_t) -1 || sector == (disk_sector_t) -2)
+					break;
+				ra_invalidate (sector, sector);
+				disk_batch_add (&batch, filesys_disk, sector, 1,
+				                inode->delay_buf + i * DISK_SECTOR_SIZE, true);
+			}
+			disk_batch_wait (&batch);
+		}
+	}
+	fat_unreserve (inode->delay_reserved);
+	inode->delay_reserved = 0;
+	palloc_free_page (inode->delay_buf);
+	inode->delay_buf = NULL;
+}
+
+/* Writes INODE back to its sector, along with the overflow blocks its
+ * extent list needs, allocating more of them as the list grows. */
+static void
+inode_store (struct inode *inode) {
+	size_t blocks = inode->data.ext_cnt > INLINE_EXTENTS
+		? DIV_ROUND_UP (inode->data.ext_cnt - INLINE_EXTENTS, EXTENTS_PER_BLOCK)
+		: 0;
+	cluster_t clst = inode->data.ext_overflow;
+	cluster_t prev = 0;
+
+	for (size_t b = 0; b < blocks; b++) {
+		if (clst == 0 || clst == EOChain) {
+			clst = fat_create_chain (prev);
+			if (clst == 0)
+				break;
+			if (prev == 0)
+				inode->data.ext_overflow = clst;
+		}
+		disk_write (filesys_disk, cluster_to_sector (clst),
+		            inode->overflow + b * EXTENTS_PER_BLOCK);
+		prev = clst;
+		clst = fat_get (clst);
+	}
+	disk_write (filesys_disk, inode->key.sector, &inode->data);
+}
+
+/* Returns where INODE keeps its directory index, for directory.c. */
+struct dir_index **
+inode_dir_index (struct inode *inode) {
+	return &inode->dir_index;
+}
+
+/* Returns the lock directory.c holds over INODE's entries and
+ * index. */
+struct lock *
+inode_dir_lock (struct inode *inode) {
+	return &inode->dir_lock;
 }
 
 void
 inode_all_close(void){
-	struct list_elem *iter = list_begin(&open_inodes);
-	while(iter != list_end(&open_inodes)){
-		struct list_elem *next = list_next(iter);
-		struct inode *inode = list_entry(iter, struct inode, elem);
+	/* Closing deletes from the table, so restart the walk each time. */
+	while(!hash_empty(&open_inodes)){
+		struct hash_iterator i;
+		hash_first(&i, &open_inodes);
+		hash_next(&i);
+		struct inode *inode = hash_entry(hash_cur(&i), struct inode, key.elem);
 		inode->open_cnt = 1;
 		inode_close(inode);
-		iter = next;
 	}
 }
\ No newline at end of file
@@ -2,7 +2,12 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <disk-stat.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,13 +20,65 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* Most sectors that disk_read_multi() and disk_write_multi()
+ * transfer with one command. */
+#define DISK_MULTI_MAX 256
+
+/* Number of I/O priority classes.  A request's class is its
+ * submitter's priority scaled to 0...DISK_IO_CLASS_CNT - 1, higher
+ * being more urgent. */
+#define DISK_IO_CLASS_CNT 4
+
+/* An asynchronous transfer between a disk and memory. */
+struct disk_request {
+	struct list_elem elem;      /* Element in the disk's queue. */
+	struct list_elem batch_elem;    /* Element in a disk_batch. */
+	struct disk *disk;          /* Disk to transfer to or from. */
+	disk_sector_t sector;       /* First sector. */
+	size_t sec_cnt;             /* Number of sectors. */
+	void *buffer;               /* SEC_CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                 /* True to write to the disk. */
+	bool flush;                 /* Cache flush barrier; no data. */
+	int io_class;               /* I/O priority class. */
+	int64_t deadline;           /* Serve no later than this tick. */
+	uint64_t submit_tsc;        /* TSC at submission, for statistics. */
+
+	/* Called on completion, if nonnull, from the disk's I/O thread
+	 * or from an interrupt handler, so it must not sleep; otherwise
+	 * COMPLETE is up'd. */
+	void (*done) (struct disk_request *);
+	void *aux;                  /* For use by DONE. */
+	struct semaphore complete;  /* Up'd on completion if DONE is null. */
+};
+
+/* A group of requests submitted together and waited on once. */
+struct disk_batch {
+	struct list requests;       /* Outstanding disk_requests. */
+	struct semaphore complete;  /* Up'd once per completed request. */
+};
+
 void disk_init (void);
 void disk_print_stats (void);
+void disk_get_stat (struct disk *, struct disk_stat *);
 
 struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multi (struct disk *, disk_sector_t, size_t, void *);
+void disk_write_multi (struct disk *, disk_sector_t, size_t, const void *);
+void disk_flush (struct disk *);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+		size_t, void *, bool write);
+void disk_submit (struct disk_request *);
+void disk_request_wait (struct disk_request *);
+void disk_complete (struct disk_request *);
+
+void disk_batch_init (struct disk_batch *);
+void disk_batch_add (struct disk_batch *, struct disk *, disk_sector_t,
+		size_t, void *, bool write);
+void disk_batch_wait (struct disk_batch *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
@@ -0,0 +1,30 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Location of a PCI function in configuration space. */
+struct pci_addr {
+	uint8_t bus;                /* Bus number. */
+	uint8_t dev;                /* Device number, 0...31. */
+	uint8_t func;               /* Function number, 0...7. */
+};
+
+/* Configuration space header offsets. */
+#define PCI_REG_ID 0x00         /* Device ID (31:16), vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04    /* Status (31:16), command (15:0). */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog-if, revision. */
+#define PCI_REG_BAR0 0x10       /* Base address registers 0...5. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line (7:0). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* I/O space enable. */
+#define PCI_CMD_MEM 0x0002      /* Memory space enable. */
+#define PCI_CMD_MASTER 0x0004   /* Bus master enable. */
+
+uint32_t pci_read_config (const struct pci_addr *, uint8_t reg);
+void pci_write_config (const struct pci_addr *, uint8_t reg, uint32_t value);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_addr *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,16 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+#include "devices/disk.h"
+
+/* Number of disk slots (hd0:0 through hd1:1) that may be backed by
+ * virtio-blk devices. */
+#define VIRTIO_BLK_SLOTS 4
+
+struct virtio_blk;
+
+struct virtio_blk *virtio_blk_probe (int slot, const char *name,
+		disk_sector_t *capacity);
+void virtio_blk_submit (struct virtio_blk *, struct disk_request *);
+
+#endif /* devices/virtio-blk.h */
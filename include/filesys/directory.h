@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "devices/disk.h"
+#include "filesys/inode.h"
 #include "filesys/symlink.h"
 /* Maximum length of a file name component.
  * This is the traditional UNIX maximum length.
@@ -14,6 +15,7 @@
 
 struct inode;
 struct symlink;
+struct dir_index;
 /* Opening and closing directories. */
 
 struct dir *dir_open (struct inode *);
@@ -25,9 +27,11 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, disk_sector_t);
+bool dir_add (struct dir *, const char *name, disk_sector_t,
+              enum inode_status);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+int dir_getdents (struct dir *, void *buf, size_t size);
 
 // my implement function
 bool dir_add_myself(struct dir *dir);
@@ -36,4 +40,7 @@ void directory_tokenize(char *dir, int *argc, char *argv[]);
 bool change_directory(const char *path, int argc, char *argv[], struct dir *dir, struct dir **new_dirp, int ofs);
 size_t dir_entry_count_used(struct dir *dir);
 struct dir *dir_duplicate (struct dir *dir);
+void dir_index_destroy (struct dir_index *);
+void dcache_init (void);
+void dcache_purge (disk_sector_t);
 #endif /* filesys/directory.h */
@@ -10,7 +10,7 @@
 
 typedef uint32_t cluster_t;  /* Index of a cluster within FAT. */
 
-#define FAT_MAGIC 0xEB3C9000 /* MAGIC string to identify FAT disk */
+#define FAT_MAGIC 0xEB3C9002 /* MAGIC string to identify FAT disk */
 #define EOChain 0x0FFFFFFF   /* End of cluster chain */
 
 /* Sectors of FAT information. */
@@ -25,20 +25,27 @@ void fat_create (void);
 void fat_close (void);
 
 cluster_t fat_create_chain (
+    cluster_t clst  /* Cluster # to stretch, 0: Create a new chain */
+);
+cluster_t fat_create_run (
     cluster_t clst, /* Cluster # to stretch, 0: Create a new chain */
-    uint32_t file_idx
+    size_t cnt,     /* Clusters to append */
+    cluster_t goal, /* Where to place them, 0: right after CLST */
+    size_t reserved /* Of CNT, clusters taken from fat_reserve() */
 );
+bool fat_reserve (size_t cnt);
+void fat_unreserve (size_t cnt);
 void fat_remove_chain (
     cluster_t clst, /* Cluster # to be removed */
     cluster_t pclst /* Previous cluster of clst, 0: clst is the start of chain */
 );
+void fat_sync (void);
 cluster_t fat_get (cluster_t clst);
 void fat_put (cluster_t clst, cluster_t val);
 disk_sector_t cluster_to_sector (cluster_t clst);
 
 // my implement functions
-void fat_info_put (cluster_t clst, uint32_t val);
-uint32_t fat_info_get (cluster_t clst);
-cluster_t fat_insert_chain(cluster_t clst, uint32_t file_idx);
+cluster_t fat_insert_chain(cluster_t clst, cluster_t goal);
+cluster_t fat_remove_run(cluster_t pclst, cluster_t clst, size_t cnt);
 cluster_t sector_to_cluster (disk_sector_t sector);
 #endif /* filesys/fat.h */
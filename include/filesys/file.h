@@ -31,5 +31,7 @@ off_t file_length (struct file *);
 
 // my implement functions
 bool file_create (disk_sector_t sector, off_t initial_size);
+bool file_fallocate (struct file *, off_t offset, off_t len);
+bool file_punch_hole (struct file *, off_t offset, off_t len);
 
 #endif /* filesys/file.h */
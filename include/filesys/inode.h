@@ -7,6 +7,13 @@
 #include "filesys/fat.h"
 struct bitmap;
 
+/* Sequential readahead state of one open file. */
+struct readahead {
+	off_t next;                 /* Where a sequential read would start. */
+	size_t window;              /* Sectors to prefetch ahead, 0: off. */
+	size_t ahead;               /* First sector index not yet prefetched. */
+};
+
 enum inode_status {
 	FILE_INODE,
 	DIR_INODE,
@@ -21,6 +28,8 @@ disk_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, struct readahead *,
+                      off_t offset, off_t size);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
@@ -30,6 +39,9 @@ off_t inode_length (const struct inode *);
 enum inode_status inode_get_type(struct inode *inode);
 bool is_inode_removed(struct inode *inode);
 void inode_grow(struct inode *inode, off_t ofs, off_t new_size);
-disk_sector_t inode_fill_lazy_clst(uint32_t pclst, off_t file_idx);
+bool inode_fallocate (struct inode *, off_t offset, off_t len);
+bool inode_punch_hole (struct inode *, off_t offset, off_t len);
 void inode_all_close(void);
+struct dir_index **inode_dir_index (struct inode *);
+struct lock *inode_dir_lock (struct inode *);
 #endif /* filesys/inode.h */
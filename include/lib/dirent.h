@@ -0,0 +1,27 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+#include <stdint.h>
+
+/* Directory entries as packed by the getdents() system call, shared
+   by the kernel and user programs. */
+
+/* Entry types. */
+enum {
+	DT_UNKNOWN,                 /* Type not known. */
+	DT_REG,                     /* Regular file. */
+	DT_DIR,                     /* Directory. */
+	DT_LNK,                     /* Symbolic link. */
+};
+
+/* One entry.  Records are packed back to back: D_RECLEN is the size
+   of this record, name and padding included, and keeps the next one
+   8-byte aligned. */
+struct dirent {
+	uint32_t d_ino;             /* Inode number. */
+	uint16_t d_reclen;          /* Bytes in this record. */
+	uint8_t d_type;             /* One of DT_*. */
+	char d_name[];              /* Null-terminated name. */
+};
+
+#endif /* lib/dirent.h */
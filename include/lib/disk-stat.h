@@ -0,0 +1,37 @@
+#ifndef __LIB_DISK_STAT_H
+#define __LIB_DISK_STAT_H
+
+#include <stdint.h>
+
+/* Per-disk I/O statistics, shared by the kernel and the diskstat()
+   system call.  Times are in time-stamp counter (TSC) cycles. */
+
+/* Number of latency histogram buckets.  Bucket I counts requests
+   whose latency, from submission to completion, was in
+   [2**I, 2**(I+1)) cycles; the last bucket also counts anything
+   longer. */
+#define DISK_LAT_BUCKETS 40
+
+/* Transfer directions. */
+enum disk_dir {
+	DISK_DIR_READ,              /* Disk to memory. */
+	DISK_DIR_WRITE,             /* Memory to disk. */
+	DISK_DIR_CNT
+};
+
+/* Statistics for one direction. */
+struct disk_dir_stat {
+	uint64_t requests;          /* Completed requests. */
+	uint64_t sequential;        /* Requests starting where the last ended. */
+	uint64_t bytes;             /* Bytes transferred. */
+	uint64_t cycles;            /* Sum of latencies. */
+	uint64_t latency[DISK_LAT_BUCKETS];     /* Latency histogram. */
+};
+
+struct disk_stat {
+	struct disk_dir_stat dir[DISK_DIR_CNT];
+	uint64_t flushes;           /* Completed cache flushes. */
+	uint64_t busy_cycles;       /* Time the channel lock was held. */
+};
+
+#endif /* lib/disk-stat.h */
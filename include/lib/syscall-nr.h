@@ -36,6 +36,11 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	SYS_DISKSTAT,               /* Reads a disk's I/O statistics. */
+	SYS_GETDENTS,               /* Reads many directory entries. */
+	SYS_FALLOCATE,              /* Reserves space in a file. */
+	SYS_PUNCH_HOLE,             /* Frees space in a file. */
 };
 
 #endif /* lib/syscall-nr.h */
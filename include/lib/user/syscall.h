@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <disk-stat.h>
+#include <dirent.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -50,6 +52,20 @@ bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char* target, const char* linkpath);
 
+/* Packs directory entries of FD into BUFFER as struct dirent records.
+   Returns the bytes filled, 0 at the end of the directory. */
+int getdents (int fd, void *buffer, unsigned size);
+
+/* Reserves space for bytes OFFSET up to OFFSET + LEN of FD without
+   writing it, growing the file if needed. */
+bool fallocate (int fd, off_t offset, off_t len);
+/* Frees the space behind bytes OFFSET up to OFFSET + LEN of FD, which
+   then read as zeros.  The file keeps its size. */
+bool punch_hole (int fd, off_t offset, off_t len);
+
+/* I/O statistics of disk DEV_NO on channel CHAN_NO. */
+bool diskstat (int chan_no, int dev_no, struct disk_stat *);
+
 static inline void* get_phys_addr (void *user_addr) {
 	void* pa;
 	asm volatile ("movq %0, %%rax" ::"r"(user_addr));
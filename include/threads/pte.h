@@ -41,5 +41,11 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=2 MiB page (PDEs only). */
+
+/* A large page is mapped by a single PDE with PTE_PS set, and must be
+   aligned to its size both virtually and physically. */
+#define LGPGSIZE (1UL << PDXSHIFT)         /* Bytes in a large page. */
+#define LGPG_CNT (LGPGSIZE / PGSIZE)       /* Pages in a large page. */
 
 #endif /* threads/pte.h */
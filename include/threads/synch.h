@@ -39,6 +39,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock {
+	struct lock lock;           /* Protects the members below. */
+	struct condition readers_ok;/* Signaled when readers may enter. */
+	struct condition writer_ok; /* Signaled when a writer may enter. */
+	unsigned readers;           /* Threads holding it for reading. */
+	unsigned writers_waiting;   /* Threads waiting to write. */
+	struct thread *writer;      /* Thread holding it for writing. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
 //implement for cond preemt
 bool compare_priority_in_waiters (const struct list_elem *, const struct list_elem *, void *aux UNUSED);
 
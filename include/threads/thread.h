@@ -12,6 +12,7 @@
 #include "threads/interrupt.h"
 
 #ifdef USERPROG
+#include "threads/mmu.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 
@@ -137,7 +138,7 @@ struct thread {
 	bool is_process;
 	struct intr_frame parent_if;
 	struct file *running_file;
-	struct lock *filesys_lock;
+	struct pcid_tag pcid_tag;           /* TLB tag of pml4. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
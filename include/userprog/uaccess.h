@@ -0,0 +1,18 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/interrupt.h"
+
+/* Returned by the accessors below when user memory is not
+   accessible. */
+#define EFAULT 14
+
+int copy_from_user (void *dst, const void *usrc, size_t size);
+int copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
+
+bool uaccess_fixup (struct intr_frame *f);
+
+#endif /* userprog/uaccess.h */
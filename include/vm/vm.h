@@ -68,11 +68,13 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * One descriptor per user pool page, preallocated by vm_init () and
+ * indexed by (kva - user pool base) / PGSIZE. A frame is in use
+ * while PAGE is non-null. */
 struct frame {
 	void *kva;
 	struct page *page;
-	struct list_elem l_elem;
 };
 
 /* The function table for page operations.
@@ -113,6 +115,8 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+extern bool vm_large_pages;
+
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
@@ -123,6 +127,8 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+struct frame *vm_frame_lookup (void *kva);
+void vm_free_frame (struct frame *frame);
 enum vm_type page_get_type (struct page *page);
 bool is_in_USER_STACK(void *uaddr);
 
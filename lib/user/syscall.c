@@ -194,3 +194,23 @@ int
 umount (const char *path) {
 	return syscall1 (SYS_UMOUNT, path);
 }
+
+bool
+diskstat (int chan_no, int dev_no, struct disk_stat *st) {
+	return syscall3 (SYS_DISKSTAT, chan_no, dev_no, st);
+}
+
+int
+getdents (int fd, void *buffer, unsigned size) {
+	return syscall3 (SYS_GETDENTS, fd, buffer, size);
+}
+
+bool
+fallocate (int fd, off_t offset, off_t len) {
+	return syscall3 (SYS_FALLOCATE, fd, offset, len);
+}
+
+bool
+punch_hole (int fd, off_t offset, off_t len) {
+	return syscall3 (SYS_PUNCH_HOLE, fd, offset, len);
+}
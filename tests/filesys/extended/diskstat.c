@@ -0,0 +1,19 @@
+/* Reads the file system disk's I/O statistics with diskstat(), then
+   checks that channels and devices that do not exist are refused. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct disk_stat st;
+
+  CHECK (diskstat (0, 1, &st), "diskstat hd0:1");
+  CHECK (st.dir[DISK_DIR_READ].requests > 0,
+         "hd0:1 has completed reads");
+  CHECK (!diskstat (2, 0, &st), "diskstat on channel 2 must fail");
+  CHECK (!diskstat (-1, 0, &st), "diskstat on channel -1 must fail");
+  CHECK (!diskstat (0, 2, &st), "diskstat on device 2 must fail");
+}
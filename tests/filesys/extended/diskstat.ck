@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(diskstat) begin
+(diskstat) diskstat hd0:1
+(diskstat) hd0:1 has completed reads
+(diskstat) diskstat on channel 2 must fail
+(diskstat) diskstat on channel -1 must fail
+(diskstat) diskstat on device 2 must fail
+(diskstat) end
+EOF
+pass;
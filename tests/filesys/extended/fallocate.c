@@ -0,0 +1,30 @@
+/* Reserves space past the end of a file with fallocate() and
+   checks that the file grows and the new range reads as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEAD_SIZE 100
+static char buf[10000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memset (buf, 'f', HEAD_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, HEAD_SIZE) == HEAD_SIZE, "write \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, sizeof buf), "fallocate \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf,
+         "filesize \"%s\" (must be %zu, actually %d)",
+         file_name, sizeof buf, filesize (fd));
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fallocate) begin
+(fallocate) create "testfile"
+(fallocate) open "testfile"
+(fallocate) write "testfile"
+(fallocate) fallocate "testfile"
+(fallocate) filesize "testfile" (must be 10000, actually 10000)
+(fallocate) close "testfile"
+(fallocate) open "testfile" for verification
+(fallocate) verified contents of "testfile"
+(fallocate) close "testfile"
+(fallocate) end
+EOF
+pass;
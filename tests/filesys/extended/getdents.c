@@ -0,0 +1,72 @@
+/* Reads a directory's entries in bulk with getdents() and checks how
+   the records are packed, then checks that a buffer too small for
+   the next entry is refused without skipping it. */
+
+#include <dirent.h>
+#include <stddef.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char *names[] = {"a", "bb", "ccc"};
+#define NAME_CNT (sizeof names / sizeof *names)
+
+static char buf[512];
+
+void
+test_main (void) 
+{
+  bool found[NAME_CNT] = {false};
+  int fd, n, ofs;
+  size_t i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  for (i = 0; i < NAME_CNT; i++)
+    {
+      char path[16] = "d/";
+      strlcpy (path + 2, names[i], sizeof path - 2);
+      CHECK (create (path, 0), "create \"%s\"", path);
+    }
+
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  msg ("getdents with an 8-byte buffer");
+  n = getdents (fd, buf, 8);
+  if (n != -1)
+    fail ("getdents returned %d, must return -1", n);
+
+  msg ("getdents \"d\"");
+  n = getdents (fd, buf, sizeof buf);
+  if (n <= 0)
+    fail ("getdents returned %d", n);
+  for (ofs = 0; ofs < n; )
+    {
+      struct dirent *d = (struct dirent *) (buf + ofs);
+      size_t len = strlen (d->d_name);
+
+      if (d->d_reclen % 8 != 0
+          || d->d_reclen < offsetof (struct dirent, d_name) + len + 1
+          || ofs + d->d_reclen > n)
+        fail ("bad record length %d for \"%s\"", d->d_reclen, d->d_name);
+      ofs += d->d_reclen;
+      if (!strcmp (d->d_name, ".") || !strcmp (d->d_name, ".."))
+        continue;
+      for (i = 0; i < NAME_CNT; i++)
+        if (!strcmp (d->d_name, names[i]))
+          break;
+      if (i == NAME_CNT)
+        fail ("unexpected entry \"%s\"", d->d_name);
+      if (found[i])
+        fail ("entry \"%s\" returned twice", d->d_name);
+      if (d->d_type != DT_REG)
+        fail ("entry \"%s\" has type %d, not DT_REG", d->d_name, d->d_type);
+      found[i] = true;
+    }
+  for (i = 0; i < NAME_CNT; i++)
+    if (!found[i])
+      fail ("entry \"%s\" missing", names[i]);
+
+  CHECK (getdents (fd, buf, sizeof buf) == 0, "getdents at end of \"d\"");
+  msg ("close \"d\"");
+  close (fd);
+}
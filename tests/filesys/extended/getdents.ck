@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(getdents) begin
+(getdents) mkdir "d"
+(getdents) create "d/a"
+(getdents) create "d/bb"
+(getdents) create "d/ccc"
+(getdents) open "d"
+(getdents) getdents with an 8-byte buffer
+(getdents) getdents "d"
+(getdents) getdents at end of "d"
+(getdents) close "d"
+(getdents) end
+EOF
+pass;
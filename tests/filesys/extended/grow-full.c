@@ -0,0 +1,58 @@
+/* Fills the disk with small appends to one file, then checks that
+   the file holds exactly what write() reported as written, and that
+   removing it gives the space back. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 100
+static char buf[CHUNK];
+static char rbuf[CHUNK];
+static const char after[] = "space is back";
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int total = 0;
+  int fd, n;
+
+  memset (buf, 'x', sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("append to \"%s\" until the disk is full", file_name);
+  while ((n = write (fd, buf, CHUNK)) > 0)
+    {
+      total += n;
+      if (n < CHUNK)
+        break;
+    }
+  CHECK (total > 0, "wrote some data before the disk filled");
+  CHECK (filesize (fd) == total, "filesize \"%s\" matches bytes written",
+         file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\" for verification",
+         file_name);
+  for (n = 0; n < total; n += CHUNK)
+    {
+      int want = total - n < CHUNK ? total - n : CHUNK;
+      if (read (fd, rbuf, want) != want || memcmp (rbuf, buf, want))
+        fail ("bad data at offset %d of \"%s\"", n, file_name);
+    }
+  msg ("verified contents of \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+  CHECK (create ("after", 0), "create \"after\"");
+  CHECK ((fd = open ("after")) > 1, "open \"after\"");
+  CHECK (write (fd, after, sizeof after - 1) == sizeof after - 1,
+         "write \"after\"");
+  msg ("close \"after\"");
+  close (fd);
+}
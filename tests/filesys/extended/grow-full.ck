@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-full) begin
+(grow-full) create "testfile"
+(grow-full) open "testfile"
+(grow-full) append to "testfile" until the disk is full
+(grow-full) wrote some data before the disk filled
+(grow-full) filesize "testfile" matches bytes written
+(grow-full) close "testfile"
+(grow-full) open "testfile" for verification
+(grow-full) verified contents of "testfile"
+(grow-full) close "testfile"
+(grow-full) remove "testfile"
+(grow-full) create "after"
+(grow-full) open "after"
+(grow-full) write "after"
+(grow-full) close "after"
+(grow-full) end
+EOF
+pass;
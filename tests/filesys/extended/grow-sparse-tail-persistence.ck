@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"testfile" => [("a" x 1000) . ("\0" x 19600) . "sparse tail"]});
+pass;
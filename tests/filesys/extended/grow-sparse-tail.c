@@ -0,0 +1,39 @@
+/* Tests that writing far past the end of a file that already has
+   data, at an offset that is not sector-aligned, leaves the bytes
+   before the write reading as zeros. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEAD_SIZE 1000
+#define TAIL_OFS 20600
+static const char tail[] = "sparse tail";
+static char buf[TAIL_OFS + sizeof tail - 1];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memset (buf, 'a', HEAD_SIZE);
+  memcpy (buf + TAIL_OFS, tail, sizeof tail - 1);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, HEAD_SIZE) == HEAD_SIZE, "write head of \"%s\"",
+         file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "reopen \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, TAIL_OFS);
+  CHECK (write (fd, tail, sizeof tail - 1) == sizeof tail - 1,
+         "write tail of \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
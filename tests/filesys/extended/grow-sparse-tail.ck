@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-tail) begin
+(grow-sparse-tail) create "testfile"
+(grow-sparse-tail) open "testfile"
+(grow-sparse-tail) write head of "testfile"
+(grow-sparse-tail) close "testfile"
+(grow-sparse-tail) reopen "testfile"
+(grow-sparse-tail) seek "testfile"
+(grow-sparse-tail) write tail of "testfile"
+(grow-sparse-tail) close "testfile"
+(grow-sparse-tail) open "testfile" for verification
+(grow-sparse-tail) verified contents of "testfile"
+(grow-sparse-tail) close "testfile"
+(grow-sparse-tail) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = join ('', map (chr (ord ('a') + $_ % 26), 0 .. 2999));
+substr ($data, 100, 2000) = "\0" x 2000;
+check_archive ({"testfile" => [$data]});
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($data) = ("p" x 10000) . ("\0" x 90000);
+substr ($data, 20000, 11) = "in the hole";
+check_archive ({"testfile" => [$data]});
+pass;
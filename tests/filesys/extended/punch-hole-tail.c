@@ -0,0 +1,44 @@
+/* Punches a hole from the middle of a file to its end, then writes
+   inside the hole and checks that the file keeps its size. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_OFS 10000
+#define WRITE_OFS 20000
+static const char data[] = "in the hole";
+static char buf[100000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  memset (buf, 'p', sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "reopen \"%s\"", file_name);
+  CHECK (punch_hole (fd, HOLE_OFS, sizeof buf - HOLE_OFS),
+         "punch hole to the end of \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, WRITE_OFS);
+  CHECK (write (fd, data, sizeof data - 1) == sizeof data - 1,
+         "write into the hole of \"%s\"", file_name);
+  CHECK (filesize (fd) == sizeof buf,
+         "filesize \"%s\" (must be %zu, actually %d)",
+         file_name, sizeof buf, filesize (fd));
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  memset (buf + HOLE_OFS, 0, sizeof buf - HOLE_OFS);
+  memcpy (buf + WRITE_OFS, data, sizeof data - 1);
+  check_file (file_name, buf, sizeof buf);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(punch-hole-tail) begin
+(punch-hole-tail) create "testfile"
+(punch-hole-tail) open "testfile"
+(punch-hole-tail) write "testfile"
+(punch-hole-tail) close "testfile"
+(punch-hole-tail) reopen "testfile"
+(punch-hole-tail) punch hole to the end of "testfile"
+(punch-hole-tail) seek "testfile"
+(punch-hole-tail) write into the hole of "testfile"
+(punch-hole-tail) filesize "testfile" (must be 100000, actually 100000)
+(punch-hole-tail) close "testfile"
+(punch-hole-tail) open "testfile" for verification
+(punch-hole-tail) verified contents of "testfile"
+(punch-hole-tail) close "testfile"
+(punch-hole-tail) end
+EOF
+pass;
@@ -0,0 +1,41 @@
+/* Punches a hole that starts and ends partway through a sector and
+   checks that the range reads as zeros, the bytes around it are
+   kept, and the file keeps its size. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_OFS 100
+#define HOLE_LEN 2000
+static char buf[3000];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  size_t i;
+  int fd;
+
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = 'a' + i % 26;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "reopen \"%s\"", file_name);
+  CHECK (punch_hole (fd, HOLE_OFS, HOLE_LEN), "punch hole in \"%s\"",
+         file_name);
+  CHECK (filesize (fd) == sizeof buf,
+         "filesize \"%s\" (must be %zu, actually %d)",
+         file_name, sizeof buf, filesize (fd));
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  memset (buf + HOLE_OFS, 0, HOLE_LEN);
+  check_file (file_name, buf, sizeof buf);
+}
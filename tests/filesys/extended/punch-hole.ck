@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(punch-hole) begin
+(punch-hole) create "testfile"
+(punch-hole) open "testfile"
+(punch-hole) write "testfile"
+(punch-hole) close "testfile"
+(punch-hole) reopen "testfile"
+(punch-hole) punch hole in "testfile"
+(punch-hole) filesize "testfile" (must be 3000, actually 3000)
+(punch-hole) close "testfile"
+(punch-hole) open "testfile" for verification
+(punch-hole) verified contents of "testfile"
+(punch-hole) close "testfile"
+(punch-hole) end
+EOF
+pass;
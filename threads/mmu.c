@@ -8,6 +8,25 @@
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Ranges longer than this many pages are flushed from the TLB with a
+ * CR3 reload rather than one invlpg per page. */
+#define TLB_FLUSH_THRESHOLD 32
+
+/* PCID support. PCID 0 belongs to base_pml4; user address spaces get
+ * 1 ~ PCID_CNT - 1. When the pool runs dry the generation advances,
+ * which makes every outstanding tag stale at once. */
+#define PCID_CNT 4096
+#define CPUID_PCID (1 << 17)            /* CPUID.01H:ECX.PCID */
+#define CR4_PCIDE (1 << 17)             /* Enable PCIDs. */
+#define CR3_NOFLUSH (1ULL << 63)        /* Keep the PCID's TLB entries. */
+
+static bool pcid_enabled;
+static uint64_t pcid_generation = 1;
+static uint16_t pcid_next = 1;
+
+static bool pml4_is_active (uint64_t *pml4);
+static void pde_split (uint64_t *pde);
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +41,12 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if ((uint64_t) pte & PTE_PS) {
+			/* VA lies in a large page. Lookups get the PDE itself;
+			 * callers about to install a 4 kB PTE split it first. */
+			if (!create)
+				return &pdp[idx];
+			pde_split (&pdp[idx]);
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -88,6 +113,44 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the next-level table that entry IDX of TABLE points to,
+ * creating it if CREATE is true. */
+static uint64_t *
+table_walk (uint64_t *table, int idx, int create) {
+	if (!(table[idx] & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		table[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return ptov (PTE_ADDR (table[idx]));
+}
+
+/* Returns the address of the page directory entry for VA in
+ * PML4E, creating the upper-level tables if CREATE is true.
+ * Unlike pml4e_walk, the entry may map a large page. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4e, const uint64_t va, int create) {
+	uint64_t *pdpe = table_walk (pml4e, PML4 (va), create);
+	uint64_t *pgdir = pdpe ? table_walk (pdpe, PDPE (va), create) : NULL;
+	return pgdir ? &pgdir[PDX (va)] : NULL;
+}
+
+/* Replaces the large page mapped by PDE with a page table of 4 kB
+ * PTEs that map the same frames with the same flags, so that single
+ * pages of it can be unmapped or evicted. The TLB entry of the large
+ * page goes away with the next invlpg of any address in it. */
+static void
+pde_split (uint64_t *pde) {
+	uint64_t *pt = palloc_get_page (PAL_ASSERT);
+	uint64_t pa = PTE_ADDR (*pde) & ~(LGPGSIZE - 1);
+	uint64_t flags = *pde & PTE_FLAGS & ~PTE_PS;
+
+	for (unsigned i = 0; i < LGPG_CNT; i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,7 +185,8 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
+		/* Large pages have no page table to walk. */
+		if ((((uint64_t) pte) & PTE_P) && !(((uint64_t) pte) & PTE_PS))
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
@@ -169,8 +233,12 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte), LGPG_CNT);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -206,6 +274,57 @@ pml4_activate (uint64_t *pml4) {
 	lcr3 (vtop (pml4 ? pml4 : base_pml4));
 }
 
+/* Turns on PCIDs if the CPU supports them. Must run while base_pml4
+ * is loaded with PCID 0. Without PCID support, pml4_activate_tagged
+ * falls back to pml4_activate. */
+void
+pcid_init (void) {
+	if ((cpuid_ecx (1) & CPUID_PCID) == 0)
+		return;
+	ASSERT ((rcr3 () & PTE_FLAGS) == 0);
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Like pml4_activate, but tags the address space with the PCID in
+ * TAG. While TAG is still valid the CR3 load keeps the TLB entries
+ * already cached for it. Otherwise TAG gets a fresh PCID, and the
+ * load flushes whatever a previous owner of that PCID left behind.
+ * Callers that change PML4 while it is not active must zero TAG. */
+void
+pml4_activate_tagged (uint64_t *pml4, struct pcid_tag *tag) {
+	enum intr_level old_level;
+	uint64_t cr3;
+
+	if (!pcid_enabled || pml4 == NULL) {
+		pml4_activate (pml4);
+		return;
+	}
+
+	old_level = intr_disable ();
+	cr3 = vtop (pml4);
+	if (tag->gen == pcid_generation)
+		cr3 |= tag->pcid | CR3_NOFLUSH;
+	else {
+		if (pcid_next == PCID_CNT) {
+			pcid_generation++;
+			pcid_next = 1;
+		}
+		tag->pcid = pcid_next++;
+		tag->gen = pcid_generation;
+		cr3 |= tag->pcid;
+	}
+	lcr3 (cr3);
+	intr_set_level (old_level);
+}
+
+/* Returns true if PML4 is the page table the CPU is using. CR3 may
+ * carry a PCID in its low bits. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
 /* Looks up the physical address that corresponds to user virtual
  * address UADDR in pml4.  Returns the kernel virtual address
  * corresponding to that physical address, or a null pointer if
@@ -216,8 +335,11 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & (LGPGSIZE - 1));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -243,6 +365,38 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 	return pte != NULL;
 }
 
+/* Adds a large page mapping in PML4 from the LGPGSIZE-aligned user
+ * virtual address UPAGE to the LGPG_CNT physically contiguous frames
+ * starting at KPAGE, which must be aligned the same way. A page
+ * table already covering UPAGE is released, as long as none of its
+ * entries is present.
+ * Returns true if successful, false if UPAGE is in use or memory
+ * allocation failed. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % LGPGSIZE == 0);
+	ASSERT (vtop (kpage) % LGPGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+	if (pde == NULL)
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		if (*pde & PTE_PS)
+			return false;
+		for (unsigned i = 0; i < LGPG_CNT; i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	if (pml4_is_active (pml4))
+		invlpg ((uint64_t) upage);
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -254,14 +408,74 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	ASSERT (is_user_vaddr (upage));
 
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	if (pte != NULL && (*pte & PTE_PS) != 0) {
+		/* Only this page goes away; keep the rest of the large page. */
+		pde_split (pte);
+		pte = pml4e_walk (pml4, (uint64_t) upage, false);
+	}
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
+		if (pml4_is_active (pml4))
 			invlpg ((uint64_t) upage);
 	}
 }
 
+/* Marks the PAGE_CNT user virtual pages starting at UPAGE "not
+ * present" in PML4, like pml4_clear_page, but walks each page table
+ * only once and defers TLB invalidation until the whole range is
+ * cleared: page by page for short ranges, or a single CR3 reload
+ * above TLB_FLUSH_THRESHOLD pages. Returns the number of pages that
+ * were present. */
+size_t
+pml4_clear_range (uint64_t *pml4, void *upage, size_t page_cnt) {
+	uint64_t va = (uint64_t) upage;
+	uint64_t end = va + page_cnt * PGSIZE;
+	size_t cleared = 0;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (page_cnt == 0 || is_user_vaddr ((void *) (end - PGSIZE)));
+
+	while (va < end) {
+		uint64_t *pte = pml4e_walk (pml4, va, false);
+		if (pte == NULL) {
+			/* No page table here: skip to the next one. */
+			va = (va | (LGPGSIZE - 1)) + 1;
+			continue;
+		}
+		if (*pte & PTE_PS) {
+			/* Drop a large page whole if the range covers it,
+			 * otherwise split it and walk the new page table. */
+			if (va % LGPGSIZE == 0 && end - va >= LGPGSIZE) {
+				*pte &= ~PTE_P;
+				cleared += LGPG_CNT;
+				va += LGPGSIZE;
+			} else
+				pde_split (pte);
+			continue;
+		}
+		/* PTEs within one page table are contiguous. */
+		do {
+			if ((*pte & PTE_P) != 0) {
+				*pte &= ~PTE_P;
+				cleared++;
+			}
+			pte++;
+			va += PGSIZE;
+		} while (va < end && PTX (va) != 0);
+	}
+
+	if (cleared > 0 && pml4_is_active (pml4)) {
+		if (page_cnt > TLB_FLUSH_THRESHOLD)
+			lcr3 (rcr3 ());
+		else
+			for (va = (uint64_t) upage; va < end; va += PGSIZE)
+				invlpg (va);
+	}
+	return cleared;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -273,7 +487,8 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
- * in PML4. */
+ * in PML4. Within a large page this sets the bit of the whole
+ * large page. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -283,7 +498,7 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
+		if (pml4_is_active (pml4))
 			invlpg ((uint64_t) vpage);
 	}
 }
@@ -299,7 +514,8 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD. Within a large page this sets the bit of the whole
+   large page. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
@@ -309,7 +525,7 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
+		if (pml4_is_active (pml4))
 			invlpg ((uint64_t) vpage);
 	}
 }
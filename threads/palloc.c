@@ -9,6 +9,7 @@
 #include <string.h>
 #include "threads/init.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -284,6 +285,38 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Obtains LGPG_CNT contiguous free pages whose physical address is
+   aligned to LGPGSIZE, suitable for backing a single large page
+   mapping, and returns the kernel virtual address of the first.
+   FLAGS are interpreted as for palloc_get_multiple(). */
+void *
+palloc_get_large (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = (LGPG_CNT - pg_no (vtop (pool->base)) % LGPG_CNT)
+		% LGPG_CNT;
+	void *pages = NULL;
+
+	lock_acquire (&pool->lock);
+	for (; page_idx + LGPG_CNT <= page_cnt; page_idx += LGPG_CNT)
+		if (bitmap_none (pool->used_map, page_idx, LGPG_CNT)) {
+			bitmap_set_multiple (pool->used_map, page_idx, LGPG_CNT, true);
+			pages = pool->base + PGSIZE * page_idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (pages) {
+		if (flags & PAL_ZERO)
+			memset (pages, 0, LGPGSIZE);
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_large: out of pages");
+	}
+
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -328,6 +361,16 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the kernel virtual address of the first page of the user
+   pool, storing the number of pages the pool spans in *PAGE_CNT.
+   Callers can index per-frame metadata by
+   (kva - base) / PGSIZE. */
+void *
+palloc_user_pool (size_t *page_cnt) {
+	*page_cnt = bitmap_size (user_pool.used_map);
+	return user_pool.base;
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -355,6 +355,91 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 		cond_signal (cond, lock);
 }
 
+/* Initializes RW, a readers-writer lock.  Any number of threads
+   may hold it for reading at once, or one thread for writing.  A
+   waiting writer keeps new readers out, so a steady stream of
+   readers cannot starve it. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	cond_init (&rw->readers_ok);
+	cond_init (&rw->writer_ok);
+	rw->readers = 0;
+	rw->writers_waiting = 0;
+	rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or is
+   waiting for it.  Read holds do not nest: a thread that takes RW
+   twice can deadlock against a writer queued in between. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_held_by_current_thread (rw));
+
+	lock_acquire (&rw->lock);
+	while (rw->writer != NULL || rw->writers_waiting > 0)
+		cond_wait (&rw->readers_ok, &rw->lock);
+	rw->readers++;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds it
+   in either mode. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (!rwlock_held_by_current_thread (rw));
+
+	lock_acquire (&rw->lock);
+	rw->writers_waiting++;
+	while (rw->writer != NULL || rw->readers > 0)
+		cond_wait (&rw->writer_ok, &rw->lock);
+	rw->writers_waiting--;
+	rw->writer = thread_current ();
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing.  Another
+   writer goes next if one is waiting; otherwise every waiting reader
+   is let in. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rwlock_held_by_current_thread (rw));
+
+	lock_acquire (&rw->lock);
+	rw->writer = NULL;
+	if (rw->writers_waiting > 0)
+		cond_signal (&rw->writer_ok, &rw->lock);
+	else
+		cond_broadcast (&rw->readers_ok, &rw->lock);
+	lock_release (&rw->lock);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  Read holders are not tracked. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	return rw->writer == thread_current ();
+}
+
 //implement for cond preemt
 
 bool 
@@ -36,7 +36,6 @@ static struct list sleep_list;
 //implment for mlfqs scheduling
 static struct list all_list;
 int load_avg;
-struct lock filesys_lock;
 struct lock swap_lock;
 
 /* Idle thread. */
@@ -123,7 +122,6 @@ thread_init (void) {
 	list_init (&sleep_list);
 	list_init (&all_list);
 	list_init (&destruction_req);
-	lock_init (&filesys_lock);
 	lock_init (&swap_lock);
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -498,7 +496,6 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->exit_status = 0;
 	list_init(&t->child_list);
 	t->is_process = false;
-	t->filesys_lock = &filesys_lock;
 #endif
 
 #ifdef VM
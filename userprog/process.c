@@ -399,6 +399,7 @@ process_cleanup (void) {
 		 * directory, or our active page directory will be one
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
+		curr->pcid_tag.gen = 0;
 		pml4_activate (NULL);
 		pml4_destroy (pml4);
 	}
@@ -409,7 +410,7 @@ process_cleanup (void) {
 void
 process_activate (struct thread *next) {
 	/* Activate thread's page tables. */
-	pml4_activate (next->pml4);
+	pml4_activate_tagged (next->pml4, &next->pcid_tag);
 
 	/* Set thread's kernel stack for use in processing interrupts. */
 	tss_update (next);
@@ -501,7 +502,6 @@ load (const char *file_name, struct intr_frame *if_) {
 
 	/* Open executable file. */
 	//implement
-	lock_acquire(curThread->filesys_lock);
 	if ((o_info = (struct open_info *)filesys_open (argv[0])) == NULL) {
 		printf ("load: %s: open failed\n", argv[0]);
 		goto done;
@@ -593,7 +593,6 @@ done:
 	/* We arrive here whether the load is successful or not. */
 	// file_close (file);
 	free(o_info);
-	lock_release(curThread->filesys_lock);
 	return success;
 }
 
@@ -756,13 +755,7 @@ lazy_load_segment (struct page *page, void *aux) {
 	ASSERT(f_info->file != NULL);
 
 	off_t bytes_read;
-	if(!lock_held_by_current_thread(thread_current()->filesys_lock)){
-		lock_acquire(thread_current()->filesys_lock);
-		bytes_read = file_read_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
-		lock_release(thread_current()->filesys_lock);
-	}else{
-		bytes_read = file_read_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
-	}
+	bytes_read = file_read_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
 
 	if(bytes_read != (off_t)f_info->read_bytes){
 		return false;
@@ -2,6 +2,7 @@
 #define USERPROG
 #include "userprog/syscall.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -14,10 +15,12 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "vm/file.h"
+#include "userprog/uaccess.h"
 
 #include "filesys/directory.h"
 #include "filesys/inode.h"
 #include "filesys/fat.h"
+#include "devices/disk.h"
 
 #define CREATE_LIMIT 512
 
@@ -32,12 +35,12 @@ enum syscall_status {
 typedef int pid_t;
 
 int insert_to_fdt(struct open_info *file);
-void check_valid_uaddr(const uint64_t *addr);
+static char *copy_in_string(const char *ustr);
 bool is_valid_fd(int fd, enum syscall_status stat);
 bool is_valid_uaddr(const uint64_t *addr, size_t length);
-void check_writable_addr(const uint64_t *addr, unsigned length);
 bool is_overlap(const uint64_t *addr, size_t length);
 bool is_valid_offset(off_t offset);
+bool is_valid_range(off_t offset, off_t len);
 bool is_writable_addr(const uint64_t *addr, unsigned length);
 
 void syscall_entry (void);
@@ -71,6 +74,10 @@ bool readdir (int fd, char *name);
 bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char *target, const char *linkpath);
+bool diskstat (int chan_no, int dev_no, struct disk_stat *st);
+int getdents (int fd, void *buffer, unsigned size);
+bool fallocate (int fd, off_t offset, off_t len);
+bool punch_hole (int fd, off_t offset, off_t len);
 
 /* System call.
  *
@@ -188,6 +195,18 @@ syscall_handler (struct intr_frame *if_) {
 	case SYS_SYMLINK:
 		if_->R.rax = symlink(if_->R.rdi, if_->R.rsi);
 		break;
+	case SYS_DISKSTAT:
+		if_->R.rax = diskstat(if_->R.rdi, if_->R.rsi, (struct disk_stat *) if_->R.rdx);
+		break;
+	case SYS_GETDENTS:
+		if_->R.rax = getdents(if_->R.rdi, (void *) if_->R.rsi, if_->R.rdx);
+		break;
+	case SYS_FALLOCATE:
+		if_->R.rax = fallocate(if_->R.rdi, if_->R.rsi, if_->R.rdx);
+		break;
+	case SYS_PUNCH_HOLE:
+		if_->R.rax = punch_hole(if_->R.rdi, if_->R.rsi, if_->R.rdx);
+		break;
 	default:
 #ifdef DEBUG
 		printf("wrong syscall number\n");
@@ -204,20 +223,15 @@ void exit (int status){
 	thread_exit();
 }
 pid_t fork (const char *thread_name, struct intr_frame *if_){
-	return process_fork(thread_name, if_);
+	/* Thread names are truncated to 16 bytes anyway, so a small
+	 * buffer on the stack is enough. */
+	char kname[16];
+	if(strncpy_from_user(kname, thread_name, sizeof kname) < 0)
+		exit(-1);
+	return process_fork(kname, if_);
 }
 int exec (const char *cmd_line){
-	check_valid_uaddr(cmd_line);
-
-	char *fn_copy;
-	if((fn_copy = palloc_get_page(PAL_ZERO)) == NULL){
-#ifdef DEBUG
-		printf("exec fn_copy NULL\n");
-#endif
-		exit(-1);
-	}
-	strlcpy(fn_copy, cmd_line, PGSIZE);
-	struct inode *inode = NULL;
+	char *fn_copy = copy_in_string(cmd_line);
 	return process_exec(fn_copy);
 }
 int wait (pid_t pid){
@@ -225,30 +239,29 @@ int wait (pid_t pid){
 }
 
 bool create (const char *file, unsigned initial_size){
-	check_valid_uaddr(file);
+	char *kfile = copy_in_string(file);
 	if(create_count > CREATE_LIMIT){
+		palloc_free_page(kfile);
 		return false;
 	}
-	lock_acquire(thread_current()->filesys_lock);
-	bool success = filesys_create(file, initial_size, FILE_INODE, NULL);
+	bool success = filesys_create(kfile, initial_size, FILE_INODE, NULL);
 	create_count++;
-	lock_release(thread_current()->filesys_lock);
+	palloc_free_page(kfile);
 	return success;
 }
 bool remove (const char *file){
-	check_valid_uaddr(file);
-	lock_acquire(thread_current()->filesys_lock);
-	bool success = filesys_remove(file);
-	lock_release(thread_current()->filesys_lock);
+	char *kfile = copy_in_string(file);
+	bool success = filesys_remove(kfile);
+	palloc_free_page(kfile);
 	return success;
 }
 int open (const char *file){
-	check_valid_uaddr(file);
+	char *kfile = copy_in_string(file);
 	int fd;
 	struct open_info *o_info;
-	lock_acquire(thread_current()->filesys_lock);
-	if((o_info = filesys_open(file)) == NULL){
-		lock_release(thread_current()->filesys_lock);
+	o_info = filesys_open(kfile);
+	palloc_free_page(kfile);
+	if(o_info == NULL){
 		return -1;
 	}
 	if ((fd = insert_to_fdt(o_info)) == -1){
@@ -259,7 +272,6 @@ int open (const char *file){
 		}
 	}
 	
-	lock_release(thread_current()->filesys_lock);
 	free(o_info);
 	return fd;
 }
@@ -268,14 +280,10 @@ int filesize (int fd){
 	if(!is_valid_fd (fd, OTHERS)) return -1;
 
 	struct file *file = curThread->fdt[fd];
-	lock_acquire(thread_current()->filesys_lock);
 	off_t result = file_length (file);
-	lock_release(thread_current()->filesys_lock);
 	return result;
 }
 int read (int fd, void *buffer, unsigned length){
-	check_valid_uaddr(buffer);
-	check_writable_addr(buffer, length);
 	if(!is_valid_fd(fd, FILE) && !is_valid_fd (fd, READ)){
 		return -1;
 	}
@@ -286,29 +294,68 @@ int read (int fd, void *buffer, unsigned length){
 		int result = input_getc();
 		return result;
 	} else{
-		void *kva;
+		/* Read through a kernel bounce page, so that a bad BUFFER
+		 * faults in copy_to_user () rather than inside the file
+		 * system. */
 		struct file *file = curThread->fdt[fd];
-		lock_acquire(thread_current()->filesys_lock);
+		uint8_t *bounce = palloc_get_page(0);
+		off_t result = 0;
+		if(bounce == NULL)
+			return -1;
 		file_deny_write(file);
-		off_t result = file_read(file, buffer, length);
-		lock_release(thread_current()->filesys_lock);
+		while(length > 0){
+			unsigned chunk = length < PGSIZE ? length : PGSIZE;
+			off_t bytes_read = file_read(file, bounce, chunk);
+			if(copy_to_user((uint8_t *) buffer + result, bounce, bytes_read) < 0){
+				palloc_free_page(bounce);
+				exit(-1);
+			}
+			result += bytes_read;
+			length -= bytes_read;
+			if((unsigned) bytes_read < chunk)
+				break;
+		}
+		palloc_free_page(bounce);
 		return result;
 	}
 }
 int write (int fd, const void *buffer, unsigned length){
-	check_valid_uaddr(buffer);
 	if(!is_valid_fd(fd, FILE) && !is_valid_fd (fd, WRITE)){
 		return -1;
 	}
 	struct thread *curThread = thread_current ();
+	uint8_t *bounce = palloc_get_page(0);
+	off_t result = 0;
+	if(bounce == NULL)
+		return -1;
 	if(fd == 1){
-		putbuf(buffer, length);
+		while(length > 0){
+			unsigned chunk = length < PGSIZE ? length : PGSIZE;
+			if(copy_from_user(bounce, (const uint8_t *) buffer + result, chunk) < 0){
+				palloc_free_page(bounce);
+				exit(-1);
+			}
+			putbuf((const char *) bounce, chunk);
+			result += chunk;
+			length -= chunk;
+		}
+		palloc_free_page(bounce);
 		return 0;
 	}else{
 		struct file *file = curThread->fdt[fd];
-		lock_acquire(thread_current()->filesys_lock);
-		off_t result = file_write(file, buffer, length);
-		lock_release(thread_current()->filesys_lock);
+		while(length > 0){
+			unsigned chunk = length < PGSIZE ? length : PGSIZE;
+			if(copy_from_user(bounce, (const uint8_t *) buffer + result, chunk) < 0){
+				palloc_free_page(bounce);
+				exit(-1);
+			}
+			off_t bytes_write = file_write(file, bounce, chunk);
+			result += bytes_write;
+			length -= bytes_write;
+			if((unsigned) bytes_write < chunk)
+				break;
+		}
+		palloc_free_page(bounce);
 		return result;
 	}
 }
@@ -316,30 +363,24 @@ void seek (int fd, unsigned position){
 	if(!is_valid_fd (fd, FILE)) return;
 	struct thread *curThread = thread_current ();
 	struct file *file = curThread->fdt[fd];
-	lock_acquire(thread_current()->filesys_lock);
 	file_seek(file, position);
 	if (position == 0) file_allow_write(file);
-	lock_release(thread_current()->filesys_lock);
 }	
 unsigned tell (int fd){
 	if(!is_valid_fd (fd, FILE)) return;
 	struct thread *curThread = thread_current ();
 	struct file *file = curThread->fdt[fd];
-	lock_acquire(thread_current()->filesys_lock);
 	off_t result = file_tell(file);
-	lock_release(thread_current()->filesys_lock);
 	return result;
 }
 void close (int fd){
 	if(!is_valid_fd (fd, OTHERS)) return;
 	struct thread *curThread = thread_current ();
-	lock_acquire(thread_current()->filesys_lock);
 	if(curThread->fdt_dirbit_vec[fd]){
 		dir_close(curThread->fdt[fd]);
 	} else {
 		file_close(curThread->fdt[fd]);
 	}
-	lock_release(thread_current()->filesys_lock);
 	curThread->fdt[fd] = NULL;
 	curThread->fdt_cur = fd < curThread->fdt_cur ? fd : curThread->fdt_cur;
 	curThread->num_files--;
@@ -366,11 +407,7 @@ void munmap(void *addr){
 }
 
 bool chdir(const char *dir){
-	char *dir_copy = palloc_get_page(PAL_ZERO);
-	if(dir_copy == NULL){
-		return false;
-	}
-	strlcpy(dir_copy, dir, PGSIZE);
+	char *dir_copy = copy_in_string(dir);
 
 	struct dir *curDir = dir_reopen(thread_current()->cwd);
 	int argc = 0;
@@ -383,7 +420,7 @@ bool chdir(const char *dir){
 	} else{
 		file_name = argv[argc-1];
 		struct dir *new_dir = NULL;
-		if(!change_directory(dir, argc, argv, curDir, &new_dir, 0)){
+		if(!change_directory(dir_copy, argc, argv, curDir, &new_dir, 0)){
 			palloc_free_page(dir_copy);
 			dir_close(curDir);
 			dir_close(new_dir);
@@ -400,14 +437,14 @@ bool chdir(const char *dir){
 }
 
 bool mkdir(const char *dir){
-	check_valid_uaddr(dir);
+	char *kdir = copy_in_string(dir);
 	if(create_count > CREATE_LIMIT){
+		palloc_free_page(kdir);
 		return false;
 	}
-	lock_acquire(thread_current()->filesys_lock);
-	bool success = filesys_create(dir, DEFAULT_ENTRY_CNT, DIR_INODE, NULL);
+	bool success = filesys_create(kdir, DEFAULT_ENTRY_CNT, DIR_INODE, NULL);
 	create_count++;
-	lock_release(thread_current()->filesys_lock);
+	palloc_free_page(kdir);
 	return success;
 }
 
@@ -416,8 +453,40 @@ bool readdir (int fd, char *name){
 	//if(!is_valid_file_name(name)) return false;
 	struct thread *curThread = thread_current();
 	struct dir* dir = curThread->fdt[fd];
+	char kname[NAME_MAX + 1];
 	if(is_inode_removed(dir_get_inode(dir))) return false;
-	return dir_readdir(dir, name);
+	if(!dir_readdir(dir, kname)) return false;
+	if(copy_to_user(name, kname, strlen(kname) + 1) < 0)
+		exit(-1);
+	return true;
+}
+
+/* Fills BUFFER with as many of FD's remaining entries as fit, packed
+ * as struct dirent records, at most a page's worth per call. */
+int getdents (int fd, void *buffer, unsigned size){
+	if(!is_valid_fd(fd, DIR)) return -1;
+	struct dir *dir = thread_current()->fdt[fd];
+	if(is_inode_removed(dir_get_inode(dir))) return 0;
+	uint8_t *bounce = palloc_get_page(0);
+	if(bounce == NULL)
+		return -1;
+	int result = dir_getdents(dir, bounce, size < PGSIZE ? size : PGSIZE);
+	if(result > 0 && copy_to_user(buffer, bounce, result) < 0){
+		palloc_free_page(bounce);
+		exit(-1);
+	}
+	palloc_free_page(bounce);
+	return result;
+}
+
+bool fallocate (int fd, off_t offset, off_t len){
+	if(!is_valid_fd(fd, FILE) || !is_valid_range(offset, len)) return false;
+	return file_fallocate(thread_current()->fdt[fd], offset, len);
+}
+
+bool punch_hole (int fd, off_t offset, off_t len){
+	if(!is_valid_fd(fd, FILE) || !is_valid_range(offset, len)) return false;
+	return file_punch_hole(thread_current()->fdt[fd], offset, len);
 }
 
 bool isdir (int fd){
@@ -440,14 +509,26 @@ int inumber (int fd){
 }
 
 int symlink (const char *target, const char *linkpath){
-	check_valid_uaddr(target);
-	check_valid_uaddr(linkpath);
-	lock_acquire(thread_current()->filesys_lock);
-	bool success = filesys_create(linkpath, strlen(target) + 1, SYMLINK_INODE, target);
-	lock_release(thread_current()->filesys_lock);
+	char *ktarget = copy_in_string(target);
+	char *klinkpath = copy_in_string(linkpath);
+	bool success = filesys_create(klinkpath, strlen(ktarget) + 1, SYMLINK_INODE, ktarget);
+	palloc_free_page(ktarget);
+	palloc_free_page(klinkpath);
 	if(success) return 0;
 	else		return -1;
 }
+bool diskstat (int chan_no, int dev_no, struct disk_stat *st){
+	struct disk_stat kst;
+	struct disk *d;
+	if(chan_no < 0 || chan_no > 1 || dev_no < 0 || dev_no > 1)
+		return false;
+	if((d = disk_get(chan_no, dev_no)) == NULL)
+		return false;
+	disk_get_stat(d, &kst);
+	if(copy_to_user(st, &kst, sizeof kst) < 0)
+		exit(-1);
+	return true;
+}
 
 int
 insert_to_fdt(struct open_info *o_info){
@@ -466,25 +547,20 @@ insert_to_fdt(struct open_info *o_info){
 	curThread->num_files++;
   	return curThread->fdt_cur;
 }
-void
-check_valid_uaddr(const uint64_t *addr){
-	struct thread *curThread = thread_current();
-	if (addr == NULL || !is_user_vaddr(addr)){
+/* Copies the user string USTR into a new page, which the caller
+ * frees with palloc_free_page (). Exits the process if USTR is not
+ * readable. */
+static char *
+copy_in_string(const char *ustr){
+	char *kstr = palloc_get_page(0);
+	if(kstr == NULL || strncpy_from_user(kstr, ustr, PGSIZE) < 0){
 #ifdef DEBUG
-		printf("addr is NULL or addr is kernel\n");
+		printf("bad user string\n");
 #endif
-    	exit(-1);
-	}
-	if(pml4_get_page(curThread->pml4, addr) == NULL){
-		struct page *page = spt_find_page(&curThread->spt, pg_round_down(addr));
-		if(page == NULL){
-			if(is_in_USER_STACK(addr) && curThread->user_rsp - 8 <= addr) return;
-#ifdef DEBUG
-			printf("no mapping and no page\n");
-#endif
-			exit(-1);
-		}
+		palloc_free_page(kstr);
+		exit(-1);
 	}
+	return kstr;
 }
 
 bool
@@ -501,6 +577,13 @@ is_valid_offset(off_t offset){
 	return true;
 }
 
+/* Checks that OFFSET and LEN name a nonempty range of bytes that fits
+ * in a file. */
+bool
+is_valid_range(off_t offset, off_t len){
+	return offset >= 0 && len > 0 && offset <= INT32_MAX - len;
+}
+
 bool
 is_valid_fd(int fd, enum syscall_status stat){
 	struct thread *curThread = thread_current ();
@@ -516,30 +599,6 @@ is_valid_fd(int fd, enum syscall_status stat){
 	return false;
 }
 
-void
-check_writable_addr(const uint64_t *addr, unsigned length){
-	struct page *page = spt_find_page(&thread_current()->spt, pg_round_down(addr));
-	if(page == NULL){
-		return;
-	}
-	if(!page->writable){
-#ifdef DEBUG
-		printf("no writable\n");
-#endif
-		exit(-1);
-	}
-	page = spt_find_page(&thread_current()->spt, pg_round_down(addr + length));
-	if(page == NULL){
-		return;
-	}
-	if(!page->writable){
-#ifdef DEBUG
-		printf("no writable\n");
-#endif
-		exit(-1);
-	}
-}
-
 bool
 is_writable_addr(const uint64_t *addr, unsigned length){
 	struct page *page = spt_find_page(&thread_current()->spt, pg_round_down(addr));
@@ -0,0 +1,130 @@
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/* Kernel access to user memory.
+
+   These helpers touch user memory directly instead of checking
+   the page tables first.  Each instruction that may fault on a
+   user address is recorded in the __ex_table section together
+   with a fixup address.  When such an instruction faults and the
+   VM cannot resolve the fault, page_fault() calls
+   uaccess_fixup(), which resumes execution at the fixup, and the
+   helper returns -EFAULT.  Valid pointers therefore cost nothing
+   beyond the copy itself. */
+
+/* An __ex_table entry: a fault at INSN resumes at FIXUP. */
+struct extable_entry {
+	uint64_t insn;
+	uint64_t fixup;
+};
+
+/* Bounds of __ex_table, from kernel.lds.S. */
+extern const struct extable_entry __start_ex_table[], __stop_ex_table[];
+
+/* Records that a fault at label FROM resumes at label TO. */
+#define EXTABLE(FROM, TO) \
+	".pushsection __ex_table, \"a\"\n" \
+	".balign 8\n" \
+	".quad " #FROM ", " #TO "\n" \
+	".popsection\n"
+
+/* Returns true if [UADDR, UADDR + SIZE) lies entirely in user
+   space.  Whether it is mapped is left to the page fault. */
+static bool
+user_range_ok (const void *uaddr, size_t size) {
+	uint64_t start = (uint64_t) uaddr;
+	return start + size >= start && start + size <= KERN_BASE;
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be in
+   user space.  Returns the number of bytes left uncopied, which
+   is nonzero only if a fault stopped the copy. */
+static size_t
+raw_copy (void *dst, const void *src, size_t size) {
+	__asm __volatile(
+		"1: rep movsb\n"
+		"2:\n"
+		EXTABLE (1b, 2b)
+		: "+D" (dst), "+S" (src), "+c" (size)
+		:
+		: "memory");
+	return size;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.
+   Returns 0 if successful, -EFAULT otherwise. */
+int
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	if (!user_range_ok (usrc, size) || raw_copy (dst, usrc, size) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.
+   Returns 0 if successful, -EFAULT otherwise. */
+int
+copy_to_user (void *udst, const void *src, size_t size) {
+	if (!user_range_ok (udst, size) || raw_copy (udst, src, size) != 0)
+		return -EFAULT;
+	return 0;
+}
+
+/* Copies the null-terminated user string USRC into DST, which has
+   room for SIZE bytes, and null-terminates DST.  Returns the
+   length of the copied string, which equals SIZE if USRC did not
+   fit, or -EFAULT if USRC is not readable. */
+int
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	size_t left = size;
+	int64_t faulted = 0;
+
+	if (size == 0)
+		return 0;
+	if ((uint64_t) usrc >= KERN_BASE)
+		return -EFAULT;
+
+	/* Stops at the terminator, after SIZE bytes, or at the first
+	   kernel address, whichever comes first. */
+	__asm __volatile(
+		"1: testq %2, %2\n"
+		"   jz 3f\n"
+		"   cmpq %4, %1\n"
+		"   jae 4f\n"
+		"2: movb (%1), %%al\n"
+		"   movb %%al, (%0)\n"
+		"   incq %1\n"
+		"   incq %0\n"
+		"   decq %2\n"
+		"   testb %%al, %%al\n"
+		"   jnz 1b\n"
+		"   jmp 3f\n"
+		"4: movq $1, %3\n"
+		"3:\n"
+		EXTABLE (2b, 4b)
+		: "+r" (dst), "+r" (usrc), "+r" (left), "+r" (faulted)
+		: "r" ((uint64_t) KERN_BASE)
+		: "rax", "memory");
+
+	if (faulted)
+		return -EFAULT;
+	if (left == 0) {
+		dst[-1] = '\0';
+		return size;
+	}
+	return size - left - 1;
+}
+
+/* If the page fault in F was raised by one of the accessors above,
+   redirects it to the accessor's fixup and returns true. */
+bool
+uaccess_fixup (struct intr_frame *f) {
+	const struct extable_entry *e;
+
+	for (e = __start_ex_table; e < __stop_ex_table; e++)
+		if (e->insn == f->rip) {
+			f->rip = e->fixup;
+			return true;
+		}
+	return false;
+}
@@ -52,9 +52,7 @@ static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
 	lock_acquire(thread_current()->swap_lock);
-	for(int i=0; i<8; i++){
-		disk_read(swap_disk, (anon_page->swap_sector * 8) + i, kva + (i * DISK_SECTOR_SIZE));
-	}
+	disk_read_multi(swap_disk, anon_page->swap_sector * 8, 8, kva);
 	bitmap_set(swap_table, anon_page->swap_sector, false);
 	lock_release(thread_current()->swap_lock);
 	page->is_in_mem = true;
@@ -73,9 +71,7 @@ anon_swap_out (struct page *page) {
 		lock_release(thread_current()->swap_lock);
 		return false;
 	}
-	for(int i=0; i<8; i++){
-		disk_write(swap_disk, (anon_page->swap_sector * 8) + i, page->frame->kva + (i * DISK_SECTOR_SIZE));
-	}
+	disk_write_multi(swap_disk, anon_page->swap_sector * 8, 8, page->frame->kva);
 	lock_release(thread_current()->swap_lock);
 	page->is_in_mem = false;
 	page->frame = NULL;
@@ -87,14 +83,15 @@ static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
 	if(!page->is_in_mem){
-		lock_acquire(thread_current()->swap_lock);
-		bitmap_set(swap_table, anon_page->swap_sector, false);
-		lock_release(thread_current()->swap_lock);
+		if(!lock_held_by_current_thread(thread_current()->swap_lock)){
+			lock_acquire(thread_current()->swap_lock);
+			bitmap_set(swap_table, anon_page->swap_sector, false);
+			lock_release(thread_current()->swap_lock);
+		}else{
+			bitmap_set(swap_table, anon_page->swap_sector, false);
+		}
 	}else{
-		lock_acquire(thread_current()->swap_lock);
-		list_remove(&page->frame->l_elem);
-		lock_release(thread_current()->swap_lock);
-		free(page->frame);
+		vm_free_frame(page->frame);
 	}
 	if(page->f_info != NULL)
 		free(page->f_info);
@@ -123,16 +120,14 @@ anon_page_copy (struct page *page, void *aux){
 		struct anon_page *anon_child_page = &page->anon;
 		size_t cache_idx = 0;
 		struct disk *swap_disk = disk_get(1, 1);
-		void *buffer = malloc(DISK_SECTOR_SIZE);
+		void *buffer = malloc(8 * DISK_SECTOR_SIZE);
 		if(buffer == NULL){
 			return false;
 		}
 		lock_acquire(thread_current()->swap_lock);
 		anon_child_page->swap_sector = bitmap_scan_and_flip(swap_table, 0, 1, false);
-		for(int i=0; i<8; i++){
-			disk_read(swap_disk, (anon_parent_page->swap_sector * 8) + i, buffer);
-			disk_write(swap_disk, (anon_child_page->swap_sector * 8) + i, buffer);
-		}
+		disk_read_multi(swap_disk, anon_parent_page->swap_sector * 8, 8, buffer);
+		disk_write_multi(swap_disk, anon_child_page->swap_sector * 8, 8, buffer);
 		lock_release(thread_current()->swap_lock);
 		free(buffer);
 		page->is_in_mem = false;
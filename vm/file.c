@@ -44,41 +44,37 @@ file_backed_swap_in (struct page *page, void *kva) {
 	struct file_info *f_info = page->f_info;
 	off_t bytes_read;
 	
-	if(!lock_held_by_current_thread(thread_current()->filesys_lock)){
-		lock_acquire(thread_current()->filesys_lock);
-		bytes_read = file_read_at(f_info->file, kva, f_info->read_bytes, f_info->offset);
-		lock_release(thread_current()->filesys_lock);
-	}else{
-		bytes_read = file_read_at(f_info->file, kva, f_info->read_bytes, f_info->offset);
-	}
+	bytes_read = file_read_at(f_info->file, kva, f_info->read_bytes, f_info->offset);
 
 	memset(kva + f_info->read_bytes, 0, f_info->zero_bytes);
 	page->is_in_mem = true;
 	return true;
 }
 
-/* Swap out the page by writeback contents to the file. */
-static bool
-file_backed_swap_out (struct page *page) {
-	struct file_page *file_page = &page->file;
+/* Writes PAGE back to its file if it has been modified since it was
+ * last written. Returns false if the write came up short. */
+bool
+file_backed_writeback (struct page *page) {
 	struct file_info *f_info = page->f_info;
 	struct thread *curThread = thread_current();
 	ASSERT(f_info->file != NULL);
-	
-	if(pml4_is_dirty(curThread->pml4, page->va)){
+
+	if(page->is_in_mem && pml4_is_dirty(curThread->pml4, page->va)){
 		off_t bytes_write;
-		if(!lock_held_by_current_thread(curThread->filesys_lock)){
-			lock_acquire(curThread->filesys_lock);
-			bytes_write = file_write_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
-			lock_release(curThread->filesys_lock);
-		}else{
-			bytes_write = file_write_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
-		}
+		bytes_write = file_write_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
 		pml4_set_dirty(curThread->pml4, page->va, false);
 		if(bytes_write != (off_t)f_info->read_bytes){
 			return false;
 		}
 	}
+	return true;
+}
+
+/* Swap out the page by writeback contents to the file. */
+static bool
+file_backed_swap_out (struct page *page) {
+	if(!file_backed_writeback(page))
+		return false;
 	page->is_in_mem = false;
 	return true;
 }
@@ -90,10 +86,7 @@ file_backed_destroy (struct page *page) {
 	
 	if(page->is_in_mem){
 		file_backed_swap_out(page);
-		lock_acquire(thread_current()->swap_lock);
-		list_remove(&page->frame->l_elem);
-		lock_release(thread_current()->swap_lock);
-		free(page->frame);
+		vm_free_frame(page->frame);
 	}
 	if(page->f_info != NULL)
 		free(page->f_info);
@@ -103,9 +96,7 @@ file_backed_destroy (struct page *page) {
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
-	lock_acquire(thread_current()->filesys_lock);
 	off_t file_len = file_length(file);
-	lock_release(thread_current()->filesys_lock);
 	if(file_len == 0) return NULL;
 
 	size_t read_bytes = length;
@@ -126,30 +117,50 @@ do_munmap (void *addr) {
 	struct supplemental_page_table *spt = &curThread->spt;
 	struct hash *mmap_table = &curThread->mmap_table;
 	struct mmap_info *m_info = mmap_find(mmap_table, addr);
-	lock_acquire(thread_current()->filesys_lock);
+	uint8_t *run = NULL;
+	size_t run_cnt = 0;
+
+	/* Unmap the whole region at once, with a single TLB flush. The
+	 * cleared PTEs keep their dirty bits for the writeback below. */
+	pml4_clear_range(curThread->pml4, addr, m_info->pages);
+
+	/* Write back dirty pages before taking swap_lock, as in
+	 * supplemental_page_table_kill (), so that other processes'
+	 * evictions do not wait on this file I/O. */
 	for(int i=0; i<m_info->pages; i++){
-		void *kva = NULL;
+		struct page *page = spt_find_page(spt, addr + PGSIZE * i);
+		if(page && VM_TYPE(page->operations->type) == VM_FILE)
+			file_backed_writeback(page);
+	}
+
+	lock_acquire(curThread->swap_lock);
+	for(int i=0; i<m_info->pages; i++){
+		uint8_t *kva = NULL;
 		struct page *page = spt_find_page(spt, addr + PGSIZE * i);
 		if(!page) continue;
-		if(page->is_in_mem){
-			void *kva = page->frame->kva;
-			pml4_clear_page(thread_current()->pml4, page->va);
-		}
+		if(page->is_in_mem)
+			kva = page->frame->kva;
 		spt_remove_page(spt, page);
-		if(kva != NULL)
-			palloc_free_page(kva);
+		if(kva == NULL)
+			continue;
+		/* Release physically contiguous frames together. */
+		if(run != NULL && kva == run + run_cnt * PGSIZE){
+			run_cnt++;
+		}else{
+			palloc_free_multiple(run, run_cnt);
+			run = kva;
+			run_cnt = 1;
+		}
 	}
-	//file_close(m_info->file);
-	lock_release(thread_current()->filesys_lock);
+	lock_release(curThread->swap_lock);
+	palloc_free_multiple(run, run_cnt);
 	mmap_remove(mmap_table, m_info);
 }
 /* my implement functions */
 static bool
 lazy_mmap_segment (struct page *page, void *aux) {
 	struct file_info *f_info = (struct file_info *)aux;
-	lock_acquire(thread_current()->filesys_lock);
 	off_t bytes_read = file_read_at(f_info->file, page->frame->kva, f_info->read_bytes, f_info->offset);
-	lock_release(thread_current()->filesys_lock);
 	if(bytes_read != (off_t)f_info->read_bytes){
 		return false;
 	}
@@ -169,9 +180,7 @@ mmap_segment (struct file *file, off_t ofs, uint8_t *upage,
 	struct mmap_info *m_info = (struct mmap_info *)malloc(sizeof(struct mmap_info));
 	m_info->start_uaddr = upage;
 	m_info->pages = 0;
-	lock_acquire(thread_current()->filesys_lock);
 	struct file *nfile = file_reopen(file);
-	lock_release(thread_current()->filesys_lock);
 	if(nfile == NULL){
 		return false;
 	}
@@ -66,10 +66,7 @@ uninit_destroy (struct page *page) {
 	/* TODO: Fill this function.
 	 * TODO: If you don't have anything to do, just return. */
 	if(page->frame != NULL){
-		lock_acquire(thread_current()->swap_lock);
-		list_remove(&page->frame->l_elem);
-		lock_release(thread_current()->swap_lock);
-		free(page->frame);
+		vm_free_frame(page->frame);
 	}
 	if(page->f_info != NULL)
 		free(page->f_info);
@@ -11,12 +11,23 @@
 
 #define MAX_STACK_SIZE (1 << 20)
 
-static struct list frame_table;
+/* Frame descriptors for every page of the user pool, indexed by
+ * frame number. */
+static struct frame *frame_table;
+static size_t frame_cnt;
+static uint8_t *frame_base;
+/* Next frame number the eviction clock examines. */
+static size_t clock_hand;
+
+/* -hugepages: map fully populated, LGPGSIZE-aligned anonymous regions
+ * with large pages. */
+bool vm_large_pages;
 
 /* my implement functions */
 unsigned page_hash_create(const struct hash_elem *e, void *aux UNUSED);
 bool page_cmp_hash(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
 static void spte_destroy(struct hash_elem *e, void *aux UNUSED);
+static void spte_writeback(struct hash_elem *e, void *aux UNUSED);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -30,8 +41,35 @@ vm_init (void) {
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
-	list_init(&frame_table);
-	//lock_init(&frame_lock);
+	frame_base = palloc_user_pool (&frame_cnt);
+	frame_table = calloc (frame_cnt, sizeof *frame_table);
+	if (frame_table == NULL)
+		PANIC ("vm_init: cannot allocate frame table");
+	for (size_t i = 0; i < frame_cnt; i++)
+		frame_table[i].kva = frame_base + i * PGSIZE;
+	clock_hand = 0;
+}
+
+/* Returns the frame descriptor for user pool page KVA. */
+struct frame *
+vm_frame_lookup (void *kva) {
+	size_t idx = ((uint8_t *) kva - frame_base) / PGSIZE;
+	ASSERT ((uint8_t *) kva >= frame_base && idx < frame_cnt);
+	return &frame_table[idx];
+}
+
+/* Marks FRAME as no longer backing any page. The underlying page of
+ * the user pool is released by whoever owns the mapping. */
+void
+vm_free_frame (struct frame *frame) {
+	struct lock *swap_lock = thread_current()->swap_lock;
+	if(!lock_held_by_current_thread(swap_lock)){
+		lock_acquire(swap_lock);
+		frame->page = NULL;
+		lock_release(swap_lock);
+	}else{
+		frame->page = NULL;
+	}
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -52,6 +90,7 @@ page_get_type (struct page *page) {
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
 static struct frame *vm_evict_frame (void);
+static bool vm_try_claim_large (struct page *page, bool *success);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -146,19 +185,20 @@ vm_get_victim (void) {
 	struct thread *curThread = thread_current();
 	/* TODO: The policy for eviction is up to you. */
 	lock_acquire(curThread->swap_lock);
-	if(!list_empty(&frame_table)){
-		while(true){
-			victim = list_entry(list_begin(&frame_table), struct frame, l_elem);
-			if(!pml4_is_accessed(curThread->pml4, victim->page->va)){
-				break;
-			} else{
-				pml4_set_accessed(curThread->pml4, victim->page->va, false);
-				list_remove(&victim->l_elem);
-				list_push_back(&frame_table, &victim->l_elem);
-			}
+	/* Clock sweep over the frame table. Two passes are enough: the
+	 * first clears every accessed bit it passes. */
+	for (size_t i = 0; i < 2 * frame_cnt; i++) {
+		struct frame *frame = &frame_table[clock_hand];
+		clock_hand = (clock_hand + 1) % frame_cnt;
+		if (frame->page == NULL)
+			continue;
+		if (!pml4_is_accessed(curThread->pml4, frame->page->va)) {
+			victim = frame;
+			break;
 		}
+		pml4_set_accessed(curThread->pml4, frame->page->va, false);
 	}
-	lock_release(thread_current()->swap_lock);
+	lock_release(curThread->swap_lock);
 	return victim;
 }
 
@@ -168,11 +208,9 @@ static struct frame *
 vm_evict_frame (void) {
 	struct frame *victim = vm_get_victim ();
 	/* TODO: swap out the victim and return the evicted frame. */
+	if (victim == NULL)
+		return NULL;
 	swap_out(victim->page);
-	lock_acquire(thread_current()->swap_lock);
-	list_remove(&victim->l_elem);
-	lock_release(thread_current()->swap_lock);
-
 	return victim;
 }
 
@@ -184,24 +222,18 @@ static struct frame *
 vm_get_frame (void) {
 	struct frame *frame = NULL;
 	/* TODO: Fill this function. */
-	frame = (struct frame *)malloc(sizeof(struct frame));
-	frame->kva = palloc_get_page(PAL_USER | PAL_ZERO);
-	frame->page = NULL;
+	void *kva = palloc_get_page(PAL_USER | PAL_ZERO);
 
-	if(frame->kva == NULL){
-		struct frame *victim = vm_evict_frame();
-		frame->kva = victim->kva;
-		pml4_clear_page(thread_current()->pml4, victim->page->va);
+	if(kva == NULL){
+		frame = vm_evict_frame();
+		ASSERT (frame != NULL);
+		pml4_clear_page(thread_current()->pml4, frame->page->va);
+		frame->page->frame = NULL;
 		memset(frame->kva, 0, PGSIZE);
-		lock_acquire(thread_current()->swap_lock);
-		list_remove(&victim->l_elem);
-		lock_release(thread_current()->swap_lock);
-		free(victim);
+	} else {
+		frame = vm_frame_lookup(kva);
 	}
-
-	lock_acquire(thread_current()->swap_lock);
-	list_push_back(&frame_table, &frame->l_elem);
-	lock_release(thread_current()->swap_lock);
+	frame->page = NULL;
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
@@ -259,6 +291,9 @@ vm_try_handle_fault (struct intr_frame *f, void *addr,
 		if (write && !page->writable) {
 			return false;
 		}
+		bool success;
+		if (vm_large_pages && vm_try_claim_large (page, &success))
+			return success;
 		return vm_do_claim_page (page);
 	}
 	
@@ -300,13 +335,80 @@ vm_do_claim_page (struct page *page) {
 	void *kva = frame->kva;
 
 	if(!pml4_set_page(curThread->pml4, upage, kva, page->writable)){
+		page->frame = NULL;
+		vm_free_frame(frame);
 		palloc_free_page(kva);
-		free(frame);
 		return false;
 	}
 	return swap_in (page, frame->kva);
 }
 
+/* Claims the whole LGPGSIZE-aligned region around PAGE with one
+ * large page. This only succeeds when every page of the region is an
+ * anonymous page that has not been loaded yet and shares PAGE's
+ * permissions. The pages keep their own frame descriptors, so each
+ * can still be evicted alone, which splits the mapping.
+ * Returns false if the caller should fall back to a 4 kB claim of
+ * PAGE. Otherwise the fault has been handled and SUCCESS tells
+ * whether PAGE was loaded. */
+static bool
+vm_try_claim_large (struct page *page, bool *success) {
+	struct thread *curThread = thread_current();
+	uint8_t *base = (uint8_t *) ((uint64_t) page->va & ~(LGPGSIZE - 1));
+	size_t page_idx = ((uint8_t *) page->va - base) / PGSIZE;
+	uint8_t *kva;
+	size_t i, j;
+
+	for (i = 0; i < LGPG_CNT; i++) {
+		struct page *p = spt_find_page(&curThread->spt, base + i * PGSIZE);
+		if (p == NULL || p->frame != NULL || p->writable != page->writable
+				|| VM_TYPE(p->operations->type) != VM_UNINIT
+				|| page_get_type(p) != VM_ANON)
+			return false;
+	}
+
+	kva = palloc_get_large(PAL_USER | PAL_ZERO);
+	if (kva == NULL)
+		return false;
+	if (!pml4_set_large_page(curThread->pml4, base, kva, page->writable)) {
+		palloc_free_multiple(kva, LGPG_CNT);
+		return false;
+	}
+
+	for (i = 0; i < LGPG_CNT; i++) {
+		struct page *p = spt_find_page(&curThread->spt, base + i * PGSIZE);
+		struct frame *frame = vm_frame_lookup(kva + i * PGSIZE);
+		frame->page = p;
+		p->frame = frame;
+		if (!swap_in (p, frame->kva))
+			break;
+	}
+	if (i == LGPG_CNT) {
+		*success = true;
+		return true;
+	}
+
+	/* Page I failed to load. Pages up to I have already been turned
+	 * into anonymous pages and cannot go back to being unloaded, so
+	 * they keep their frames under 4 kB mappings, page I just as
+	 * vm_do_claim_page () leaves a page whose swap_in () failed. The
+	 * pages after I are still unloaded: unmap them, drop their links
+	 * and release their frames. */
+	pml4_clear_range(curThread->pml4, base + (i + 1) * PGSIZE,
+			LGPG_CNT - i - 1);
+	for (j = i + 1; j < LGPG_CNT; j++) {
+		struct page *p = spt_find_page(&curThread->spt, base + j * PGSIZE);
+		vm_free_frame(p->frame);
+		p->frame = NULL;
+	}
+	palloc_free_multiple(kva + (i + 1) * PGSIZE, LGPG_CNT - i - 1);
+
+	if (page_idx > i)
+		return false;
+	*success = page_idx < i;
+	return true;
+}
+
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt) {
@@ -381,7 +483,13 @@ void
 supplemental_page_table_kill (struct supplemental_page_table *spt) {
 	/* TODO: Destroy all the supplemental_page_table hold by thread and
 	 * TODO: writeback all the modified contents to the storage. */
+	/* Write back dirty file pages first, so that file I/O is not done
+	 * while holding swap_lock. The destroy pass then runs under a
+	 * single swap_lock acquisition instead of one per page. */
+	hash_apply (&spt->hash_table, spte_writeback);
+	lock_acquire(thread_current()->swap_lock);
 	hash_clear (&spt->hash_table, spte_destroy);
+	lock_release(thread_current()->swap_lock);
 }
 
 /* my implement functions */
@@ -405,6 +513,14 @@ spte_destroy(struct hash_elem *e, void *aux UNUSED){
 	vm_dealloc_page(page);
 }
 
+// hash_action_func
+static void
+spte_writeback(struct hash_elem *e, void *aux UNUSED){
+	struct page *page = hash_entry(e, struct page, h_elem);
+	if(VM_TYPE(page->operations->type) == VM_FILE)
+		file_backed_writeback(page);
+}
+
 bool is_in_USER_STACK(void *uaddr){
 	return USER_STACK - MAX_STACK_SIZE <= uaddr  &&
 			uaddr < USER_STACK;